@@ -0,0 +1,113 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting
+ * work.
+  *
+  */
+
+#include "autotune.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/utsname.h>
+#endif
+
+// The value of the first "key : value" line of /proc/cpuinfo with the key
+static std::string cpuinfo_value(const char *sKey) {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || line.compare(0, strlen(sKey), sKey) != 0)
+      continue;
+    size_t start = line.find_first_not_of(" \t", colon + 1);
+    return start == std::string::npos ? "" : line.substr(start);
+  }
+  return "unknown";
+}
+
+std::string autotune_cache::host_key() {
+  std::string key = cpuinfo_value("model name");
+  key += " | microcode " + cpuinfo_value("microcode");
+#ifndef _WIN32
+  utsname name;
+  if (uname(&name) == 0)
+    key += std::string(" | ") + name.sysname + " " + name.release;
+#else
+  key += " | Windows";
+#endif
+  return key;
+}
+
+bool autotune_cache::load(const char *sFilename, size_t iThreads,
+                          std::vector<entry> &vEntries) {
+  std::ifstream in(sFilename);
+  std::string line;
+  bool bHostOk = false;
+
+  vEntries.clear();
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    if (line.compare(0, 5, "host ") == 0) {
+      bHostOk = line.substr(5) == host_key();
+      continue;
+    }
+
+    std::istringstream fields(line);
+    std::string tag, prefetch;
+    entry e;
+    if (!(fields >> tag >> e.iCpuAff >> e.iMaxWays >> e.sBackend >> e.iWays >>
+          prefetch >> e.fHps) ||
+        tag != "thread")
+      return false;
+    e.bNoPrefetch = prefetch == "no_prefetch";
+    vEntries.push_back(e);
+  }
+
+  return bHostOk && !vEntries.empty() && vEntries.size() == iThreads;
+}
+
+bool autotune_cache::save(const char *sFilename,
+                          const std::vector<entry> &vEntries) {
+  std::ofstream out(sFilename, std::ios::trunc);
+  out << "# Hash kernels picked by the autotuner, delete this file or start "
+         "with --retune to measure again\n";
+  out << "host " << host_key() << "\n";
+  out << "# thread affinity max_ways backend ways prefetch H/s\n";
+  for (const entry &e : vEntries)
+    out << "thread " << e.iCpuAff << " " << e.iMaxWays << " " << e.sBackend
+        << " " << e.iWays << " " << (e.bNoPrefetch ? "no_prefetch" : "prefetch")
+        << " " << e.fHps << "\n";
+  return out.good();
+}
+
+bool autotune_cache::fits(const entry &e, long long iCpuAff, size_t iMaxWays,
+                          const std::vector<std::string> &vBackends) {
+  return e.iCpuAff == iCpuAff && e.iMaxWays == iMaxWays &&
+         std::find(vBackends.begin(), vBackends.end(), e.sBackend) !=
+             vBackends.end() &&
+         e.iWays >= 1 && e.iWays <= iMaxWays;
+}
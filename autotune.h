@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// The kernels the autotuner picked, kept in a file so the next start on the same
+// host can skip the measurement. A new CPU, microcode or kernel makes the file stale.
+class autotune_cache
+{
+public:
+	// One line per thread, in the order of cpu_threads_conf. The affinity and the way
+	// limit are the thread config the kernel was measured with.
+	struct entry
+	{
+		long long iCpuAff;
+		size_t iMaxWays;
+		std::string sBackend;
+		size_t iWays;
+		bool bNoPrefetch;
+		double fHps;
+	};
+
+	// The CPU model, its microcode revision and the kernel release
+	static std::string host_key();
+
+	// False if the file is missing, unreadable, was written on another host or for
+	// another number of threads
+	static bool load(const char* sFilename, size_t iThreads, std::vector<entry>& vEntries);
+	static bool save(const char* sFilename, const std::vector<entry>& vEntries);
+
+	// Whether an entry still holds for a thread with this config, given the backends
+	// the CPU and aes_override allow now
+	static bool fits(const entry& e, long long iCpuAff, size_t iMaxWays,
+		const std::vector<std::string>& vBackends);
+};
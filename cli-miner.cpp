@@ -42,6 +42,7 @@
 #include <string.h>
 
 #include <time.h>
+#include <vector>
 
 #ifndef CONF_NO_TLS
 #include <openssl/err.h>
@@ -63,6 +64,7 @@ void win_exit() { return; }
 #endif // _WIN32
 
 void do_benchmark();
+void do_layout_benchmark();
 
 int main(int argc, char *argv[]) {
 #ifndef CONF_NO_TLS
@@ -78,10 +80,24 @@ int main(int argc, char *argv[]) {
 
   const char *sFilename = "config.txt";
   bool benchmark_mode = false;
+  bool benchmark_layouts = false;
+  bool retune = false;
+
+  // --retune may come anywhere, the other arguments go by position
+  std::vector<char *> args;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--retune") == 0)
+      retune = true;
+    else
+      args.push_back(argv[i]);
+  }
+  argc = (int)args.size();
+  argv = args.data();
 
   if (argc >= 2) {
     if (strcmp(argv[1], "-h") == 0) {
-      printer::inst()->print_msg(L0, "Usage %s [CONFIG FILE]", argv[0]);
+      printer::inst()->print_msg(L0, "Usage %s [--retune] [CONFIG FILE]",
+                                 argv[0]);
       win_exit();
       return 0;
     }
@@ -91,6 +107,9 @@ int main(int argc, char *argv[]) {
     } else if (argc >= 3 && strcasecmp(argv[1], "benchmark_mode") == 0) {
       sFilename = argv[2];
       benchmark_mode = true;
+    } else if (argc >= 3 && strcasecmp(argv[1], "benchmark_layouts") == 0) {
+      sFilename = argv[2];
+      benchmark_layouts = true;
     } else
       sFilename = argv[1];
   }
@@ -112,12 +131,21 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  // With autotune this measures the kernels, or reads them from the cache
+  minethd::select_kernels(retune);
+
   if (benchmark_mode) {
     do_benchmark();
     win_exit();
     return 0;
   }
 
+  if (benchmark_layouts) {
+    do_layout_benchmark();
+    win_exit();
+    return 0;
+  }
+
 #ifndef CONF_NO_HTTPD
   if (jconf::inst()->GetHttpdPort() != 0) {
     if (!httpd::inst()->start_daemon()) {
@@ -142,6 +170,13 @@ int main(int argc, char *argv[]) {
            "Configurable dev donation level is set to %.1f %%\n\n",
            fDevDonationLevel * 100.0);
   printer::inst()->print_str(buffer);
+  snprintf(buffer, sizeof(buffer), "Hash kernels: %s\n",
+           minethd::aes_backend_name().c_str());
+  printer::inst()->print_str(buffer);
+  snprintf(buffer, sizeof(buffer), "Kernel set: %s\n",
+           minethd::kernel_set_name().c_str());
+  printer::inst()->print_str(buffer);
+  printer::inst()->print_str("\n");
   printer::inst()->print_str(
       "You can use following keys to display reports:\n");
   printer::inst()->print_str("'h' - hashrate\n");
@@ -196,14 +231,13 @@ int main(int argc, char *argv[]) {
 
 void do_benchmark() {
   using namespace std::chrono;
-  std::map<int, minethd *> *pvThreads;
 
   printer::inst()->print_msg(L0, "Running a 60 second benchmark...");
 
   uint8_t work[76] = {0};
   minethd::miner_work oWork =
       minethd::miner_work("", work, sizeof(work), 0, 0, false, 0);
-  pvThreads = minethd::thread_starter(oWork);
+  minethd::thread_starter(oWork);
 
   uint64_t iStartStamp =
       time_point_cast<milliseconds>(high_resolution_clock::now())
@@ -215,10 +249,12 @@ void do_benchmark() {
   oWork = minethd::miner_work();
   minethd::switch_work(oWork);
 
+  std::vector<minethd::thd_stats> vStats;
+  minethd::stats_snapshot(vStats);
   double fTotalHps = 0.0;
-  for (uint32_t i = 0; i < pvThreads->size(); i++) {
-    double fHps = pvThreads->at(i)->iHashCount;
-    fHps /= (pvThreads->at(i)->iTimestamp - iStartStamp) / 1000.0;
+  for (uint32_t i = 0; i < vStats.size(); i++) {
+    double fHps = vStats[i].iHashCount;
+    fHps /= (vStats[i].iTimestamp - iStartStamp) / 1000.0;
 
     printer::inst()->print_msg(L0, "Thread %u: %.1f H/S", i, fHps);
     fTotalHps += fHps;
@@ -226,3 +262,28 @@ void do_benchmark() {
 
   printer::inst()->print_msg(L0, "Total: %.1f H/S", fTotalHps);
 }
+
+void do_layout_benchmark() {
+  // Aligned, then staggered by a line, by a line more than a page and so on
+  const size_t iColours[] = {0, 64, 1024, 4096 + 64, 16384 + 64, 65536 + 64};
+  const size_t iSeconds = 20;
+  size_t iBest = 0;
+  double fBestHps = 0.0;
+
+  printer::inst()->print_msg(
+      L0, "Comparing scratchpad layouts, %llu seconds each...",
+      int_port(iSeconds));
+
+  for (size_t iColour : iColours) {
+    double fHps = minethd::layout_benchmark(iColour, iSeconds);
+    printer::inst()->print_msg(L0, "scratchpad_offset %6llu: %.1f H/S",
+                               int_port(iColour), fHps);
+    if (fHps > fBestHps) {
+      fBestHps = fHps;
+      iBest = iColour;
+    }
+  }
+
+  printer::inst()->print_msg(
+      L0, "Fastest layout: \"scratchpad_offset\" : %llu", int_port(iBest));
+}
@@ -32,6 +32,7 @@
 #define _BLAKE256_H_
 
 #include <stdint.h>
+#include "kernel_level.h"
 
 typedef struct {
   uint32_t h[8], s[4], t[2];
@@ -56,6 +57,10 @@ void blake224_final(state *, uint8_t *);
 void blake256_hash(uint8_t *, const uint8_t *, uint64_t);
 void blake224_hash(uint8_t *, const uint8_t *, uint64_t);
 
+/* four messages of the same length at once, with SSE2 where available: */
+
+void blake256_hash_x4(uint8_t *const out[4], const uint8_t *const in[4], uint64_t inlen);
+
 /* HMAC functions: */
 
 void hmac_blake256_init(hmac_state *, const uint8_t *, uint64_t);
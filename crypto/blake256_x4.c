@@ -0,0 +1,129 @@
+/*
+ * BLAKE-256 of four messages of the same length at once, one message
+ * per 32 bit lane of an SSE2 register. The rounds are the ones of
+ * blake256_compress in blake256.c, the padding is what blake256_final
+ * ends up doing for a whole number of bytes.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "blake256.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+#define U8TO32(p) \
+    (((uint32_t)((p)[0]) << 24) | ((uint32_t)((p)[1]) << 16) |    \
+     ((uint32_t)((p)[2]) <<  8) | ((uint32_t)((p)[3])      ))
+#define U32TO8(p, v) \
+    (p)[0] = (uint8_t)((v) >> 24); (p)[1] = (uint8_t)((v) >> 16); \
+    (p)[2] = (uint8_t)((v) >>  8); (p)[3] = (uint8_t)((v)      );
+
+/* the permutations and constants, from blake256.c */
+extern const uint8_t sigma[][16];
+extern const uint32_t cst[16];
+
+static const uint32_t iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+#define ROT(x,n) _mm_or_si128(_mm_slli_epi32((x), 32 - (n)), _mm_srli_epi32((x), (n)))
+#define G(a,b,c,d,e)                                                                      \
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]),                                       \
+                         _mm_xor_si128(m[sigma[i][e]], _mm_set1_epi32(cst[sigma[i][e+1]]))); \
+    v[d] = ROT(_mm_xor_si128(v[d], v[a]), 16);                                            \
+    v[c] = _mm_add_epi32(v[c], v[d]);                                                     \
+    v[b] = ROT(_mm_xor_si128(v[b], v[c]), 12);                                            \
+    v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]),                                       \
+                         _mm_xor_si128(m[sigma[i][e+1]], _mm_set1_epi32(cst[sigma[i][e]]))); \
+    v[d] = ROT(_mm_xor_si128(v[d], v[a]), 8);                                             \
+    v[c] = _mm_add_epi32(v[c], v[d]);                                                     \
+    v[b] = ROT(_mm_xor_si128(v[b], v[c]), 7);
+
+/* t is the bit counter of the block, 0 for a block of padding only */
+static void blake256_compress_x4(__m128i h[8], const uint8_t *const block[4], uint64_t t) {
+    __m128i v[16], m[16];
+    int i;
+
+    for (i = 0; i < 16; ++i)
+        m[i] = _mm_set_epi32(U8TO32(block[3] + i * 4), U8TO32(block[2] + i * 4),
+                             U8TO32(block[1] + i * 4), U8TO32(block[0] + i * 4));
+    for (i = 0; i < 8;  ++i) v[i] = h[i];
+    v[ 8] = _mm_set1_epi32(0x243F6A88);
+    v[ 9] = _mm_set1_epi32(0x85A308D3);
+    v[10] = _mm_set1_epi32(0x13198A2E);
+    v[11] = _mm_set1_epi32(0x03707344);
+    v[12] = _mm_set1_epi32(0xA4093822 ^ (uint32_t)t);
+    v[13] = _mm_set1_epi32(0x299F31D0 ^ (uint32_t)t);
+    v[14] = _mm_set1_epi32(0x082EFA98 ^ (uint32_t)(t >> 32));
+    v[15] = _mm_set1_epi32(0xEC4E6C89 ^ (uint32_t)(t >> 32));
+
+    for (i = 0; i < 14; ++i) {
+        G(0, 4,  8, 12,  0);
+        G(1, 5,  9, 13,  2);
+        G(2, 6, 10, 14,  4);
+        G(3, 7, 11, 15,  6);
+        G(3, 4,  9, 14, 14);
+        G(2, 7,  8, 13, 12);
+        G(0, 5, 10, 15,  8);
+        G(1, 6, 11, 12, 10);
+    }
+
+    for (i = 0; i < 8; ++i) h[i] = _mm_xor_si128(h[i], _mm_xor_si128(v[i], v[i + 8]));
+}
+
+// inlen = number of bytes, the same for all four
+void blake256_hash_x4(uint8_t *const out[4], const uint8_t *const in[4], uint64_t inlen) {
+    uint8_t pad[4][128];
+    const uint8_t *blocks[4];
+    uint64_t offset, rest, bits = inlen * 8;
+    __m128i h[8];
+    int i, n, padblocks;
+
+    for (i = 0; i < 8; ++i) h[i] = _mm_set1_epi32(iv[i]);
+
+    for (offset = 0; inlen - offset >= 64; offset += 64) {
+        for (n = 0; n < 4; ++n) blocks[n] = in[n] + offset;
+        blake256_compress_x4(h, blocks, (offset + 64) * 8);
+    }
+
+    /* the message is followed by a 1 bit, zeros, a 1 bit and the 64 bit length,
+       in a second block if that does not fit behind the rest of the message */
+    rest = inlen - offset;
+    padblocks = rest < 56 ? 1 : 2;
+    for (n = 0; n < 4; ++n) {
+        memset(pad[n], 0, sizeof(pad[n]));
+        memcpy(pad[n], in[n] + offset, rest);
+        pad[n][rest] = 0x80;
+        pad[n][padblocks * 64 - 9] |= 0x01;
+        U32TO8(pad[n] + padblocks * 64 - 8, (uint32_t)(bits >> 32));
+        U32TO8(pad[n] + padblocks * 64 - 4, (uint32_t)bits);
+    }
+
+    for (n = 0; n < 4; ++n) blocks[n] = pad[n];
+    blake256_compress_x4(h, blocks, rest == 0 ? 0 : bits);
+    if (padblocks == 2) {
+        for (n = 0; n < 4; ++n) blocks[n] = pad[n] + 64;
+        blake256_compress_x4(h, blocks, 0);
+    }
+
+    for (i = 0; i < 8; ++i) {
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, h[i]);
+        for (n = 0; n < 4; ++n) {
+            U32TO8(out[n] + i * 4, lanes[n]);
+        }
+    }
+}
+
+#else
+
+// inlen = number of bytes, the same for all four
+void blake256_hash_x4(uint8_t *const out[4], const uint8_t *const in[4], uint64_t inlen) {
+    int n;
+    for (n = 0; n < 4; ++n) blake256_hash(out[n], in[n], inlen);
+}
+
+#endif
@@ -0,0 +1,146 @@
+/*!
+ * @file context.hpp
+ * What the kernels of all x86-64 levels share: the exception type and
+ * the part of a hash context the mining loop talks to
+ */
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/*!
+ * An array type to make returning / taking fixed-size C
+ * arrays more pleasant
+ */
+namespace array
+{
+/*!
+ * Create a C array of the given type:
+ * array::type<uint8_t, 64>
+ */
+template <typename T, size_t N> using type = T[N];
+
+/*!
+ * Create a C array of the given type from an arbitrary array:
+ * auto x = array::of<uint8_t, 64>(my_pointer);
+ */
+template <size_t N, typename T> type<T, N> &of(T *x)
+{
+  return reinterpret_cast<type<T, N> &>(*x);
+}
+}
+
+namespace cryptonight
+{
+
+/*!
+ * Exceptions thrown for serious initialisation events only
+ * Initialisation should only be performed once per thread so
+ * this shouldn't be seen during operation.
+ */
+class Exception : public std::exception
+{
+private:
+  //! Local message storage
+  std::string m_message;
+
+public:
+  /*!
+   * Construct with a new message
+   * \param message The message
+   */
+  Exception(const std::string &message) : m_message(message)
+  {
+  }
+
+  /*!
+   * Return the message for information purposes
+   * \return The message
+   */
+  const char *what() const noexcept
+  {
+    return m_message.c_str();
+  }
+};
+
+/*!
+ * A hash context as the mining loop sees it. The Cryptonight classes of
+ * every level derive from it, so the loop drives a context of any
+ * KernelSet without knowing which level built it.
+ */
+class alignas(16) Context
+{
+protected:
+  //! Our storage of the result
+  alignas(16) uint8_t m_result[64];
+  //! The flag that aborts the hash in flight, may be null
+  const std::atomic<bool> *m_cancel;
+  //! True when the last hash was aborted by the cancel flag
+  bool m_aborted;
+
+public:
+  //! Base constructor, no cancel flag and nothing aborted
+  Context() : m_cancel(nullptr), m_aborted(false)
+  {
+  }
+
+  //! Destroy the context of whichever level built it
+  virtual ~Context();
+
+  /*!
+   * Set the blob the following hashNext calls work on
+   * \param in  The blob
+   * \param len The length of the blob, at most MAX_BLOB_SIZE
+   */
+  virtual void setBlob(const uint8_t *in, size_t len) = 0;
+
+  /*!
+   * Return the result of the last calculation
+   * \return The result
+   */
+  inline array::type<uint8_t, 64> &result()
+  {
+    return array::of<64>(m_result);
+  }
+
+  /*!
+   * Set the flag that aborts the hash in flight. The iterations look at
+   * it every CANCEL_CHUNK rounds and give up on the hash when it is set,
+   * leaving a meaningless result and aborted() true
+   * \param flag The flag, or null to always finish the hash
+   */
+  inline void setCancelFlag(const std::atomic<bool> *flag)
+  {
+    m_cancel = flag;
+  }
+
+  /*!
+   * Whether the last hash was aborted, its result is then meaningless
+   * \return True if aborted
+   */
+  inline bool aborted() const
+  {
+    return m_aborted;
+  }
+
+  /*!
+   * Whether any hash of the last batch was aborted. The base
+   * calculateResults() hashes one context after the other, so the flag
+   * may rise between two of them and abort only the later ones
+   * \param ctx The N contexts of the batch
+   * \return True if at least one result is meaningless
+   */
+  template <size_t N, typename T> static bool anyAborted(const T *const *ctx)
+  {
+    for (size_t i = 0; i < N; ++i)
+      if (ctx[i]->aborted())
+        return true;
+    return false;
+  }
+};
+}
+
+#endif  // CONTEXT_HPP
@@ -7,16 +7,13 @@
 #include <assert.h>
 #include <cstdlib>
 
-#ifdef __linux
-#include <sys/mman.h>
-#endif
-
 extern "C" {
 #include "blake256.h"
 #include "jh.h"
 #include "skein.h"
 }
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -60,19 +57,24 @@ static void oaes_word_rot_left(uint8_t word[4])
   memcpy(word, _temp, 4);
 }
 
-void Cryptonight::initRoundKeys(size_t offset)
+//! Size of the expanded key schedule
+static const size_t KEYS_SIZE = Cryptonight::AES_KEY_SIZE * 10;
+
+static inline void expandKeys(const uint8_t *key, uint8_t *keys)
 {
+  static const size_t AES_KEY_SIZE = Cryptonight::AES_KEY_SIZE;
+
   // the first _ctx->key->data_len are a direct copy
-  memcpy(m_keys, m_keccak + offset, AES_KEY_SIZE);
+  memcpy(keys, key, AES_KEY_SIZE);
 
   // apply ExpandKey algorithm for remainder
   static const size_t OAES_RKEY_LEN = 4;
   static const size_t OAES_COL_LEN  = 4;
   static const size_t BASE          = AES_KEY_SIZE / OAES_RKEY_LEN;
-  for (size_t i = BASE; i < sizeof(m_keys) / OAES_RKEY_LEN; i++)
+  for (size_t i = BASE; i < KEYS_SIZE / OAES_RKEY_LEN; i++)
   {
-    uint8_t *this_key = m_keys + i * OAES_RKEY_LEN;
-    memcpy(this_key, m_keys + (i - 1) * OAES_RKEY_LEN, OAES_COL_LEN);
+    uint8_t *this_key = keys + i * OAES_RKEY_LEN;
+    memcpy(this_key, keys + (i - 1) * OAES_RKEY_LEN, OAES_COL_LEN);
 
     // transform key column
     if (i % 8 == 0)
@@ -89,20 +91,26 @@ void Cryptonight::initRoundKeys(size_t offset)
     }
     for (size_t j = 0; j < OAES_COL_LEN; j++)
     {
-      m_keys[i * OAES_RKEY_LEN + j] ^= m_keys[i * OAES_RKEY_LEN - AES_KEY_SIZE + j];
+      keys[i * OAES_RKEY_LEN + j] ^= keys[i * OAES_RKEY_LEN - AES_KEY_SIZE + j];
     }
   }
 }
 
+void Cryptonight::initRoundKeys(size_t offset)
+{
+  static_assert(sizeof(m_keys) == KEYS_SIZE, "Key schedule size mismatch");
+  expandKeys(m_keccak + offset, m_keys);
+}
+
 array::type<uint8_t, 32> &Cryptonight::roundKey(size_t i)
 {
   return array::of<32>(&m_keys[i * AES_KEY_SIZE]);
 }
 
-static inline void SubAndShiftAndMixAddRound(uint8_t *out8, uint8_t *state, uint8_t *aesenckey8)
+static inline void SubAndShiftAndMixAddRound(uint8_t *out8, uint8_t *state, const uint8_t *aesenckey8)
 {
   uint32_t *out32       = reinterpret_cast<uint32_t *>(out8);
-  uint32_t *aesenckey32 = reinterpret_cast<uint32_t *>(aesenckey8);
+  const uint32_t *aesenckey32 = reinterpret_cast<const uint32_t *>(aesenckey8);
   out32[0] = (TestTable1[state[0]]) ^ (TestTable2[state[5]]) ^ (TestTable3[state[10]]) ^ (TestTable4[state[15]]) ^
              aesenckey32[0];
   out32[1] = (TestTable4[state[3]]) ^ (TestTable1[state[4]]) ^ (TestTable2[state[9]]) ^ (TestTable3[state[14]]) ^
@@ -113,31 +121,36 @@ static inline void SubAndShiftAndMixAddRound(uint8_t *out8, uint8_t *state, uint
              aesenckey32[3];
 }
 
-static inline void SubAndShiftAndMixAddRoundInPlace(uint8_t *out, uint8_t *AesEncKey)
+static inline void SubAndShiftAndMixAddRoundInPlace(uint8_t *out, const uint8_t *AesEncKey)
 {
   alignas(16) uint8_t state[16];
   memcpy(state, out, sizeof(state));
   SubAndShiftAndMixAddRound(out, state, AesEncKey);
 }
 
-void Cryptonight::explodeScratchPad()
+static inline void explode(const uint8_t *keys, const uint8_t *keccak, uint8_t *pad)
 {
-  alignas(16) uint8_t text[INIT_SIZE_BYTE];
-  memcpy(text, m_keccak + 64, sizeof(text));
+  alignas(16) uint8_t text[Cryptonight::INIT_SIZE_BYTE];
+  memcpy(text, keccak + 64, sizeof(text));
 
-  for (size_t i = 0; i < MEMORY / INIT_SIZE_BYTE; ++i)
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; ++i)
   {
     for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
     {
       for (size_t k = 0; k < 10; ++k)
       {
-        SubAndShiftAndMixAddRoundInPlace(text + j * Cryptonight::AES_BLOCK_SIZE, &m_keys[k * 16]);
+        SubAndShiftAndMixAddRoundInPlace(text + j * Cryptonight::AES_BLOCK_SIZE, &keys[k * 16]);
       }
     }
-    memcpy(&m_scratchpad[i * INIT_SIZE_BYTE], text, INIT_SIZE_BYTE);
+    memcpy(&pad[i * Cryptonight::INIT_SIZE_BYTE], text, Cryptonight::INIT_SIZE_BYTE);
   }
 }
 
+void Cryptonight::explodeScratchPad()
+{
+  explode(m_keys, m_keccak, m_scratchpad.get());
+}
+
 std::tuple<Cryptonight::stack_type, Cryptonight::stack_type> Cryptonight::initAandB()
 {
   stack_type a, b;
@@ -201,12 +214,17 @@ void Cryptonight::iteration(size_t total)
   stack_type a, b, c;
   std::tie(a, b) = initAandB();
 
-  for (size_t i = 0; i < total; ++i)
+  for (size_t done = 0; done < total; done += CANCEL_CHUNK)
   {
-    SubAndShiftAndMixAddRound(c.v, &m_scratchpad[stateIndex(a)], a.v);
-    xor_blocks_dst(c.v, b.v, &m_scratchpad[stateIndex(a)]);
-    mul_sum_xor_dst(c.v, a.v, &m_scratchpad[stateIndex(c)]);
-    memcpy(b.v, c.v, sizeof(c.v));
+    if (cancelled()) return;
+    const size_t chunk = total - done < CANCEL_CHUNK ? total - done : CANCEL_CHUNK;
+    for (size_t i = 0; i < chunk; ++i)
+    {
+      SubAndShiftAndMixAddRound(c.v, &m_scratchpad[stateIndex(a)], a.v);
+      xor_blocks_dst(c.v, b.v, &m_scratchpad[stateIndex(a)]);
+      mul_sum_xor_dst(c.v, a.v, &m_scratchpad[stateIndex(c)]);
+      memcpy(b.v, c.v, sizeof(c.v));
+    }
   }
 }
 
@@ -218,6 +236,18 @@ void Cryptonight::initKeccak(const uint8_t *in, size_t len)
   keccak1600(in, len, m_keccak);
 }
 
+void Cryptonight::initKeccaks(uint8_t *const *states, size_t n, const uint8_t *in, size_t len)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const uint8_t *inputs[4] = {in + i * len, in + (i + 1) * len, in + (i + 2) * len, in + (i + 3) * len};
+    keccak1600_x4(inputs, len, states + i);
+  }
+  for (; i < n; ++i)
+    keccak1600(in + i * len, len, states[i]);
+}
+
 void Cryptonight::iterations()
 {
   iteration(ITER / 2);
@@ -229,29 +259,65 @@ static inline void xor_blocks(uint8_t *a, const uint8_t *b)
   ((uint64_t *)a)[1] ^= ((uint64_t *)b)[1];
 }
 
-void Cryptonight::implodeScratchPad()
+static inline void implode(const uint8_t *keys, const uint8_t *pad, uint8_t *keccak)
 {
-  for (size_t i = 0; i < MEMORY / INIT_SIZE_BYTE; i++)
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; i++)
   {
-    for (size_t j = 0; j < INIT_SIZE_BLOCK; j++)
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; j++)
     {
-      uint8_t *block = m_keccak + 64 + j * AES_BLOCK_SIZE;
-      xor_blocks(block, &m_scratchpad[i * INIT_SIZE_BYTE + j * AES_BLOCK_SIZE]);
+      uint8_t *block = keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE;
+      xor_blocks(block, &pad[i * Cryptonight::INIT_SIZE_BYTE + j * Cryptonight::AES_BLOCK_SIZE]);
       for (size_t k = 0; k < 10; ++k)
       {
-        SubAndShiftAndMixAddRoundInPlace(block, &m_keys[k * AES_BLOCK_SIZE]);
+        SubAndShiftAndMixAddRoundInPlace(block, &keys[k * Cryptonight::AES_BLOCK_SIZE]);
       }
     }
   }
 }
 
+void Cryptonight::implodeScratchPad()
+{
+  implode(m_keys, m_scratchpad.get(), m_keccak);
+}
+
 void Cryptonight::rerunKeccak()
 {
+  // The state is stored little endian, only swap where that is not native
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
   for (size_t i = 0; i < sizeof(m_keccak) / sizeof(uint64_t); ++i)
     set64(m_keccak, i, swab64(get64(m_keccak, i)));
+#endif
   keccakf(reinterpret_cast<uint64_t *>(m_keccak), 24);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
   for (size_t i = 0; i < sizeof(m_keccak) / sizeof(uint64_t); ++i)
     set64(m_keccak, i, swab64(get64(m_keccak, i)));
+#endif
+}
+
+void Cryptonight::rerunKeccaks(uint8_t *const *states, size_t n)
+{
+  static const size_t WORDS = 25;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    uint64_t st[4][WORDS];
+    for (size_t w = 0; w < 4; ++w)
+      for (size_t j = 0; j < WORDS; ++j)
+        st[w][j] = get64(states[i + w], j);
+    keccakf_x4(st, 24);
+    for (size_t w = 0; w < 4; ++w)
+      for (size_t j = 0; j < WORDS; ++j)
+        set64(states[i + w], j, st[w][j]);
+  }
+  for (; i < n; ++i)
+  {
+    uint64_t st[WORDS];
+    for (size_t j = 0; j < WORDS; ++j)
+      st[j] = get64(states[i], j);
+    keccakf(st, 24);
+    for (size_t j = 0; j < WORDS; ++j)
+      set64(states[i], j, st[j]);
+  }
 }
 
 Cryptonight::HashType Cryptonight::hashType() const
@@ -259,23 +325,95 @@ Cryptonight::HashType Cryptonight::hashType() const
   return HashType(m_keccak[0] & 3);
 }
 
-array::type<uint8_t, 64> &Cryptonight::calculateResult()
+void Cryptonight::finalizeResult(const uint8_t *state, uint8_t *result, bool aes)
 {
-  switch (hashType())
+  switch (HashType(state[0] & 3))
   {
   case BLAKE256:
-    blake256_hash(m_result, m_keccak, 200);
+    blake256_hash(result, state, 200);
     break;
   case GROESTL:
-    groestl(m_keccak, 200 * 8, m_result);
+#ifdef __x86_64
+    if (aes)
+    {
+      groestl_aesni(state, 200 * 8, result);
+      break;
+    }
+#endif
+    groestl(state, 200 * 8, result);
     break;
   case JH:
-    jh_hash(32 * 8, m_keccak, 200 * 8, m_result);
+#ifdef __SSE2__
+    jh_hash_sse2(32 * 8, state, 200 * 8, result);
+#else
+    jh_hash(32 * 8, state, 200 * 8, result);
+#endif
     break;
   case SKEIN:
-    skein_hash(32 * 8, m_keccak, 200 * 8, m_result);
+    skein_hash(32 * 8, state, 200 * 8, result);
     break;
   }
+}
+
+void Cryptonight::finalizeResults(const uint8_t *const *states, uint8_t *const *results, size_t n, bool aes)
+{
+#ifdef __x86_64
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+  static const size_t LANES = 4;
+  uint8_t scratch[LANES - 1][32];
+
+  for (size_t start = 0; start < n; start += MAX_WAYS)
+  {
+    const size_t count = n - start < MAX_WAYS ? n - start : MAX_WAYS;
+    const uint8_t *in[4][MAX_WAYS];
+    uint8_t *out[4][MAX_WAYS];
+    size_t fill[4] = {};
+
+    // Group by hash type, the pointers keep every result in its place
+    for (size_t i = start; i < start + count; ++i)
+    {
+      const size_t type = states[i][0] & 3;
+      in[type][fill[type]]    = states[i];
+      out[type][fill[type]++] = results[i];
+    }
+
+    for (size_t type = 0; type < 4; ++type)
+    {
+      bool multi = type == BLAKE256;
+#ifdef __x86_64
+      multi = multi || (type == SKEIN && have_avx2);
+#endif
+      size_t i = 0;
+      // Two or more of a kind are cheaper in one multi-buffer call, the
+      // lanes left over hash the last state again into scratch space
+      while (multi && fill[type] - i >= 2)
+      {
+        const uint8_t *lanesIn[LANES];
+        uint8_t *lanesOut[LANES];
+        for (size_t l = 0; l < LANES; ++l)
+        {
+          const bool used = i + l < fill[type];
+          lanesIn[l]      = used ? in[type][i + l] : in[type][fill[type] - 1];
+          lanesOut[l]     = used ? out[type][i + l] : scratch[l - 1];
+        }
+        if (type == BLAKE256)
+          blake256_hash_x4(lanesOut, lanesIn, 200);
+#ifdef __x86_64
+        else
+          skein512_256_x4_avx2(lanesIn, 200, lanesOut);
+#endif
+        i = std::min(i + LANES, fill[type]);
+      }
+      for (; i < fill[type]; ++i)
+        finalizeResult(in[type][i], out[type][i], aes);
+    }
+  }
+}
+
+array::type<uint8_t, 64> &Cryptonight::calculateResult()
+{
+  finalizeResult(m_keccak, m_result, m_aesFinalizer);
   return array::of<64>(m_result);
 }
 
@@ -286,23 +424,53 @@ array::type<uint8_t, 64> &Cryptonight::calculateResult(const uint8_t *in, size_t
   explodeScratchPad();
   initAandB();
   iterations();
+  if (m_aborted) return result();
   initRoundKeys(32);
   implodeScratchPad();
   rerunKeccak();
   return calculateResult();
 }
 
-Cryptonight::Cryptonight() : m_scratchpad(nullptr, ::free)
+array::type<uint8_t, 64> &Cryptonight::hash(const uint8_t *in, size_t len)
+{
+  alignas(16) uint8_t keys[KEYS_SIZE];
+
+  m_speculated = false;
+  initKeccak(in, len);
+  expandKeys(m_keccak, keys);
+  explode(keys, m_keccak, m_scratchpad.get());
+  Cryptonight::iteration(ITER / 2);
+  if (m_aborted) return result();
+  expandKeys(m_keccak + 32, keys);
+  implode(keys, m_scratchpad.get(), m_keccak);
+  rerunKeccak();
+  return calculateResult();
+}
+
+void Cryptonight::setBlob(const uint8_t *in, size_t len)
+{
+  assert(len <= sizeof(m_blob) && len >= NONCE_OFFSET + sizeof(uint32_t));
+  memcpy(m_blob, in, len);
+  m_blobLen    = len;
+  m_speculated = false;
+}
+
+const uint8_t *Cryptonight::blobWithNonce(uint32_t nonce)
+{
+  set32byte(m_blob, NONCE_OFFSET, nonce);
+  return m_blob;
+}
+
+array::type<uint8_t, 64> &Cryptonight::hashNext(uint32_t nonce)
+{
+  return hash(blobWithNonce(nonce), m_blobLen);
+}
+
+Cryptonight::Cryptonight() : Cryptonight(Scratchpad::allocate(MEMORY))
+{
+}
+
+Cryptonight::Cryptonight(const Scratchpad &scratchpad)
+    : m_scratchpad(scratchpad), m_blobLen(0), m_speculated(false), m_aesFinalizer(false)
 {
-  void *memory;
-#ifndef __sparc
-  if (::posix_memalign(&memory, AES_BLOCK_SIZE, MEMORY) != 0) throw std::bad_alloc();
-#else
-  if ((memory = malloc(MEMORY)) == nullptr) throw std::bad_alloc();
-#endif
-  m_scratchpad.reset(reinterpret_cast<uint8_t *>(memory));
-#ifdef __linux
-  madvise(memory, MEMORY, MADV_RANDOM | MADV_WILLNEED | MADV_HUGEPAGE);
-  if (!geteuid()) mlock(memory, MEMORY);
-#endif
 }
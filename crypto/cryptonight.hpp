@@ -5,73 +5,27 @@
 #ifndef CRYPTONIGHT_HPP
 #define CRYPTONIGHT_HPP
 
+#include "context.hpp"
+#include "kernel_level.h"
 #include "portability.hpp"
+#include "scratchpad.hpp"
 #include "gtest/gtest_prod.h"
+#include <atomic>
 #include <chrono>
 #include <memory>
+#include <string>
 #include <unistd.h>
 
-/*!
- * An array type to make returning / taking fixed-size C
- * arrays more pleasant
- */
-namespace array
-{
-/*!
- * Create a C array of the given type:
- * array::type<uint8_t, 64>
- */
-template <typename T, size_t N> using type = T[N];
-
-/*!
- * Create a C array of the given type from an arbitrary array:
- * auto x = array::of<uint8_t, 64>(my_pointer);
- */
-template <size_t N, typename T> type<T, N> &of(T *x)
-{
-  return reinterpret_cast<type<T, N> &>(*x);
-}
-}
-
 namespace cryptonight
 {
-
-/*!
- * Exceptions thrown for serious initialisation events only
- * Initialisation should only be performed once per thread so
- * this shouldn't be seen during operation.
- */
-class Exception : public std::exception
-{
-private:
-  //! Local message storage
-  std::string m_message;
-
-public:
-  /*!
-   * Construct with a new message
-   * \param message The message
-   */
-  Exception(const std::string &message) : m_message(message)
-  {
-  }
-
-  /*!
-   * Return the message for information purposes
-   * \return The message
-   */
-  const char *what() const noexcept
-  {
-    return m_message.c_str();
-  }
-};
+XMR_KERNEL_NAMESPACE_BEGIN
 
 /*!
  * The cryptonight class provides the base implementation
  * of the Cryptonight algorithm that should work on all
  * processors
  */
-class alignas(16) Cryptonight
+class alignas(16) Cryptonight : public Context
 {
 public:
   //! Total size of scratch-pad memory
@@ -88,14 +42,20 @@ public:
   static const size_t INIT_SIZE_BYTE = (INIT_SIZE_BLOCK * AES_BLOCK_SIZE);
   //! Total number of AES blocks in the scratch pad
   static const size_t TOTALBLOCKS = (MEMORY / AES_BLOCK_SIZE);
+  //! Maximum number of hashes a single thread calculates in lockstep
+  static const size_t MAX_WAYS = 5;
+  //! Largest block blob the mining loop hashes
+  static const size_t MAX_BLOB_SIZE = 112;
+  //! Position of the 32 bit nonce inside the blob
+  static const size_t NONCE_OFFSET = 39;
+  //! Iterations between two looks at the cancel flag, tens of microseconds
+  static const size_t CANCEL_CHUNK = 1 << 10;
 
 protected:
   //! Our storage of the keccak state
   alignas(16) uint8_t m_keccak[200];
   //! Our storage of the AES keys
   alignas(16) uint8_t m_keys[AES_KEY_SIZE * 10];
-  //! Our storage of the result
-  alignas(16) uint8_t m_result[64];
 
   //! The stack type is a simple aligned block
   //! This will be redefined by more precise implementations
@@ -105,7 +65,42 @@ protected:
   };
 
   //! Our scratchpad memory
-  std::unique_ptr<uint8_t[], decltype(&::free)> m_scratchpad;
+  Scratchpad m_scratchpad;
+
+  //! The blob the mining loop is working on
+  uint8_t m_blob[MAX_BLOB_SIZE];
+  //! The length of the blob
+  size_t m_blobLen;
+  //! True when the scratchpad is already exploded for m_speculatedNonce
+  bool m_speculated;
+  //! The nonce the scratchpad was speculatively exploded for
+  uint32_t m_speculatedNonce;
+  //! True when the finalizers may use hardware AES
+  bool m_aesFinalizer;
+
+  /*!
+   * Look at the cancel flag, called between chunks of iterations
+   * \return True if the hash in flight has to be aborted
+   */
+  inline bool cancelled()
+  {
+    m_aborted = m_cancel != nullptr && m_cancel->load(std::memory_order_relaxed);
+    return m_aborted;
+  }
+
+  /*!
+   * Look at the cancel flag for N contexts of one batch, they all
+   * share the flag of their thread so the first one decides
+   * \param ctx The N contexts
+   * \return True if the hashes in flight have to be aborted
+   */
+  template <size_t N, typename T> static bool cancelled(T *const *ctx)
+  {
+    const bool cancel = ctx[0]->cancelled();
+    for (size_t i = 1; i < N; ++i)
+      ctx[i]->m_aborted = cancel;
+    return cancel;
+  }
 
   /*!
    * Tests that require private / protected access to this class
@@ -122,6 +117,7 @@ protected:
   template <typename T> FRIEND_TEST(HashCorrect, IterationsCorrect);
   template <typename T> FRIEND_TEST(HashCorrect, EncryptedKeccakCorrect);
   template <typename T> FRIEND_TEST(HashCorrect, RerunKeccakCorrect);
+  template <typename T> FRIEND_TEST(HashCorrect, VectorJH);
 
   /*!
    * Perform the 64 bit multiply and add function:
@@ -132,10 +128,41 @@ protected:
    */
   static void mul_sum_xor_dst(const uint8_t *a, uint8_t *c, uint8_t *dst);
 
+  /*!
+   * Initialise n Keccak states, four at a time where possible
+   * \param states The n states
+   * \param n      The number of states
+   * \param in     The n inputs, one after the other
+   * \param len    The length of each input
+   */
+  static void initKeccaks(uint8_t *const *states, size_t n, const uint8_t *in, size_t len);
+
+  /*!
+   * Re-run keccak on n states, four at a time where possible
+   * \param states The n states
+   * \param n      The number of states
+   */
+  static void rerunKeccaks(uint8_t *const *states, size_t n);
+
 public:
   //! Base constructor initializes memory, does no processing
   Cryptonight();
 
+  /*!
+   * Construct on a scratchpad of an arena instead of slow memory of our own
+   * \param scratchpad The scratchpad, MEMORY bytes long
+   */
+  explicit Cryptonight(const Scratchpad &scratchpad);
+
+  /*!
+   * Return the scratchpad, to see where its memory comes from
+   * \return The scratchpad
+   */
+  inline const Scratchpad &scratchpad() const
+  {
+    return m_scratchpad;
+  }
+
   //! Initialise the Keccak state with a new input byte stream
   void initKeccak(const uint8_t *in, size_t len);
   //! Calculate the round keys (not that slow)
@@ -153,6 +180,32 @@ public:
   //! Re-run keccak at the end
   void rerunKeccak();
 
+  /*!
+   * Initialise the Keccak state of N contexts in one batch
+   * \param ctx The N contexts
+   * \param in  The N inputs, one after the other
+   * \param len The length of each input
+   */
+  template <size_t N, typename T> static void initKeccaks(T *const *ctx, const uint8_t *in, size_t len)
+  {
+    uint8_t *states[N];
+    for (size_t i = 0; i < N; ++i)
+      states[i] = ctx[i]->m_keccak;
+    initKeccaks(states, N, in, len);
+  }
+
+  /*!
+   * Re-run keccak at the end on N contexts in one batch
+   * \param ctx The N contexts
+   */
+  template <size_t N, typename T> static void rerunKeccaks(T *const *ctx)
+  {
+    uint8_t *states[N];
+    for (size_t i = 0; i < N; ++i)
+      states[i] = ctx[i]->m_keccak;
+    rerunKeccaks(states, N);
+  }
+
   /*!
    * 128 bit multiplication of a & b
    * \param a  LHS parameter
@@ -186,6 +239,43 @@ public:
    */
   array::type<uint8_t, 64> &calculateResult();
 
+  /*!
+   * Apply the final hash function of a re-run Keccak state
+   * \param state  The Keccak state, its first byte selects the hash
+   * \param result The 32 byte result
+   * \param aes    True to run Groestl on hardware AES
+   */
+  static void finalizeResult(const uint8_t *state, uint8_t *result, bool aes = false);
+
+  /*!
+   * Apply the final hash functions of n re-run Keccak states. The states
+   * are grouped by hash type, and groups of the same type go through
+   * the multi-buffer versions of BLAKE-256 and Skein where possible.
+   * Every result still ends up behind its own pointer.
+   * \param states  The n Keccak states
+   * \param results The n results
+   * \param n       The number of states
+   * \param aes     True to run Groestl on hardware AES
+   */
+  static void finalizeResults(const uint8_t *const *states, uint8_t *const *results, size_t n, bool aes = false);
+
+  /*!
+   * Calculate the results of N contexts in one batch. Requires all other
+   * stages have been performed in order on every context
+   * \param ctx The N contexts
+   */
+  template <size_t N, typename T> static void finalizeResults(T *const *ctx)
+  {
+    const uint8_t *states[N];
+    uint8_t *results[N];
+    for (size_t i = 0; i < N; ++i)
+    {
+      states[i]  = ctx[i]->m_keccak;
+      results[i] = ctx[i]->m_result;
+    }
+    finalizeResults(states, results, N, ctx[0]->m_aesFinalizer);
+  }
+
   /*!
    * Calculate the result from an input vector. Performs all stages
    * internally in this function.
@@ -195,6 +285,74 @@ public:
    */
   array::type<uint8_t, 64> &calculateResult(const uint8_t *in, size_t len);
 
+  /*!
+   * Calculate the result from an input vector without going through
+   * the virtual stages. Every stage is called directly so the whole
+   * pipeline can be inlined, and the round keys never leave the stack.
+   * Extensions hide this with their own pipeline.
+   * \param in  The input byte array
+   * \param len The length of the array
+   * \return The calculated result
+   */
+  array::type<uint8_t, 64> &hash(const uint8_t *in, size_t len);
+
+  /*!
+   * Set the blob the following hashNext calls work on
+   * \param in  The blob
+   * \param len The length of the blob, at most MAX_BLOB_SIZE
+   */
+  void setBlob(const uint8_t *in, size_t len) override;
+
+  /*!
+   * Write a nonce into the stored blob
+   * \param nonce The nonce
+   * \return The blob, blobLength() bytes long
+   */
+  const uint8_t *blobWithNonce(uint32_t nonce);
+
+  /*!
+   * Return the length of the stored blob
+   * \return The length
+   */
+  inline size_t blobLength() const
+  {
+    return m_blobLen;
+  }
+
+  /*!
+   * Calculate the result for the stored blob with the given nonce.
+   * Extensions may use this to overlap the end of one hash with the
+   * start of the next one, so call it with consecutive nonces.
+   * \param nonce The nonce
+   * \return The calculated result
+   */
+  array::type<uint8_t, 64> &hashNext(uint32_t nonce);
+
+  /*!
+   * Calculate N results at once, one per context. The inputs are
+   * stored one after the other, each of them len bytes long.
+   * The base implementation simply hashes one after the other,
+   * extensions may interleave the contexts.
+   * \param ctx The N contexts, one for each input
+   * \param in  The N input byte arrays
+   * \param len The length of each of the arrays
+   */
+  template <size_t N, typename T> static void calculateResults(T *const *ctx, const uint8_t *in, size_t len)
+  {
+    for (size_t i = 0; i < N; ++i)
+      ctx[i]->hash(in + i * len, len);
+  }
+
+  /*!
+   * Let the finalizers use hardware AES. Set by whoever picked the AES
+   * backend, so the aes_override setting covers Groestl too
+   * \param aes True if hardware AES may be used
+   */
+  inline void setAesFinalizer(bool aes)
+  {
+    m_aesFinalizer = aes;
+  }
+
   /*!
    * Calculate state index given a stack variable
    * \param a The stack variable
@@ -253,8 +411,10 @@ public:
 inline void cryptonight(const uint8_t *in, size_t len, char *out)
 {
   Cryptonight ctx;
-  auto &r = ctx.calculateResult(reinterpret_cast<const uint8_t *>(in), len);
+  auto &r = ctx.hash(reinterpret_cast<const uint8_t *>(in), len);
   std::copy(r, r + sizeof(r), out);
 }
+
+XMR_KERNEL_NAMESPACE_END
 }
 #endif  // CRYPTONIGHT_HPP
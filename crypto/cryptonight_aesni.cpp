@@ -1,11 +1,13 @@
 #include "cryptonight_aesni.hpp"
+#include "cryptonight_vaes.hpp"
+#include "keccak.h"
 #include <signal.h>
 #include <string.h>
 #include <x86intrin.h>
 
 using namespace cryptonight;
 
-void aes_256_assist1(__m128i *t1, __m128i *t2)
+static void aes_256_assist1(__m128i *t1, __m128i *t2)
 {
   __m128i t4;
   *t2 = _mm_shuffle_epi32(*t2, 0xff);
@@ -17,7 +19,7 @@ void aes_256_assist1(__m128i *t1, __m128i *t2)
   *t1 = _mm_xor_si128(*t1, t4);
   *t1 = _mm_xor_si128(*t1, *t2);
 }
-void aes_256_assist2(__m128i *t1, __m128i *t3)
+static void aes_256_assist2(__m128i *t1, __m128i *t3)
 {
   __m128i t2, t4;
   t4  = _mm_aeskeygenassist_si128(*t1, 0x00);
@@ -31,11 +33,11 @@ void aes_256_assist2(__m128i *t1, __m128i *t3)
   *t3 = _mm_xor_si128(*t3, t2);
 }
 
-void CryptonightAESNI::initRoundKeys(size_t offset)
+//! Expand the 256 bit key, ek needs room for 11 round keys
+static inline void expandKeys(const uint8_t *key, __m128i *ek)
 {
-  __m128i *ek = R128(m_keys);
-  __m128i t1  = _mm_loadu_si128(R128(m_keccak + offset));
-  __m128i t3  = _mm_loadu_si128(R128(m_keccak + offset + 16));
+  __m128i t1 = _mm_loadu_si128(R128(key));
+  __m128i t3 = _mm_loadu_si128(R128(key + 16));
 
   ek[0] = t1;
   ek[1] = t3;
@@ -69,94 +71,263 @@ void CryptonightAESNI::initRoundKeys(size_t offset)
   ek[10] = t1;
 }
 
-uint64_t CryptonightAESNI::mul128(uint64_t a, uint64_t b, uint64_t *hi)
+//! Run the 10 rounds on all the blocks of a line, the blocks are independent
+static inline void encryptLine(const __m128i *keys, __m128i *x)
 {
-  uint64_t t2[2];
-  __asm__("mulq %3\n\t" : "=d"(t2[0]), "=a"(t2[1]) : "%a"(a), "rm"(b) : "cc");
-  *hi = t2[0];
-  return t2[1];
+  for (size_t k = 0; k < 10; ++k)
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      x[j] = _mm_aesenc_si128(x[j], keys[k]);
 }
 
-void CryptonightAESNI::iteration(size_t total)
+static inline void explode(bool useVAES, const __m128i *keys, const uint8_t *keccak, uint8_t *pad)
 {
-  auto tpl = initAandB();
+  if (useVAES)
+    return vaes::explode(keys, keccak, pad, Cryptonight::MEMORY);
 
-  stack_type _a = _mm_load_si128(R128(std::get<0>(tpl).v));
-  stack_type _b = _mm_load_si128(R128(std::get<1>(tpl).v));
-  stack_type _c;
+  __m128i x[Cryptonight::INIT_SIZE_BLOCK];
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    x[j] = _mm_loadu_si128(R128(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE));
 
-  for (size_t i = 0; i < total; ++i)
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; ++i)
   {
-    uint64_t t0[2];
-    _mm_store_si128(R128(t0), _a);
-    auto index0 = stateIndex(t0);
-    _c          = _mm_load_si128(R128(&m_scratchpad[index0]));
-    _c          = _mm_aesenc_si128(_c, _a);
-
-    uint64_t t1[2];
-    _mm_store_si128(R128(t1), _c);
-    auto index1 = stateIndex(t1);
-    __builtin_prefetch(&m_scratchpad[index1]);
-
-    _b = _mm_xor_si128(_b, _c);
-    _mm_store_si128(R128(&m_scratchpad[index0]), _b);
-
-    uint64_t *p = (uint64_t *)(&m_scratchpad[index1]);
+    encryptLine(keys, x);
+    __m128i *line = R128(pad + i * Cryptonight::INIT_SIZE_BYTE);
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      _mm_store_si128(line + j, x[j]);
+  }
+}
 
-    uint64_t t2[2];
-    __asm__("mulq %3\n\t" : "=d"(t2[0]), "=a"(t2[1]) : "%a"(t1[0]), "rm"(p[0]) : "cc");
-    _b = _mm_load_si128(R128(p));
+static inline void implode(bool useVAES, const __m128i *keys, const uint8_t *pad, uint8_t *keccak)
+{
+  if (useVAES)
+    return vaes::implode(keys, pad, keccak, Cryptonight::MEMORY);
 
-    _a = _mm_add_epi64(_a, *R128(t2));
+  __m128i x[Cryptonight::INIT_SIZE_BLOCK];
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    x[j] = _mm_loadu_si128(R128(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE));
 
-    _mm_store_si128(R128(p), _a);
-    _a = _mm_xor_si128(_a, _b);
-    _b = _c;
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; ++i)
+  {
+    const __m128i *line = R128(pad + i * Cryptonight::INIT_SIZE_BYTE);
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      x[j] = _mm_xor_si128(x[j], _mm_load_si128(line + j));
+    encryptLine(keys, x);
   }
+
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    _mm_storeu_si128(R128(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE), x[j]);
 }
 
-void CryptonightAESNI::explodeScratchPad()
+/*!
+ * Implode the scratchpad with one set of keys and explode it again
+ * for the next hash with another, reading and writing each line once
+ */
+static inline void implodeExplode(bool useVAES, const __m128i *keys, const __m128i *nextKeys, uint8_t *keccak,
+                                  const uint8_t *nextKeccak, uint8_t *pad)
 {
-  uint8_t text[INIT_SIZE_BYTE];
-  memcpy(text, m_keccak + 64, sizeof(text));
+  if (useVAES)
+    return vaes::implodeExplode(keys, nextKeys, keccak, nextKeccak, pad, Cryptonight::MEMORY);
 
-  for (size_t i = 0; i < MEMORY / INIT_SIZE_BYTE; ++i)
+  __m128i x[Cryptonight::INIT_SIZE_BLOCK], y[Cryptonight::INIT_SIZE_BLOCK];
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
   {
-    __m128i *keys = R128(m_keys);
+    x[j] = _mm_loadu_si128(R128(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE));
+    y[j] = _mm_loadu_si128(R128(nextKeccak + 64 + j * Cryptonight::AES_BLOCK_SIZE));
+  }
+
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; ++i)
+  {
+    __m128i *line = R128(pad + i * Cryptonight::INIT_SIZE_BYTE);
     for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      x[j] = _mm_xor_si128(x[j], _mm_load_si128(line + j));
+    for (size_t k = 0; k < 10; ++k)
     {
-      __m128i d = _mm_loadu_si128(R128(text + j * Cryptonight::AES_BLOCK_SIZE));
-      for (size_t k = 0; k < 10; ++k)
+      for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
       {
-        d = _mm_aesenc_si128(d, *R128(&keys[k]));
+        x[j] = _mm_aesenc_si128(x[j], keys[k]);
+        y[j] = _mm_aesenc_si128(y[j], nextKeys[k]);
       }
-      _mm_storeu_si128((R128(text + j * Cryptonight::AES_BLOCK_SIZE)), d);
     }
-    memcpy(m_scratchpad.get() + i * INIT_SIZE_BYTE, text, INIT_SIZE_BYTE);
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      _mm_store_si128(line + j, y[j]);
   }
+
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    _mm_storeu_si128(R128(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE), x[j]);
 }
 
-void CryptonightAESNI::implodeScratchPad()
+void CryptonightAESNI::initRoundKeys(size_t offset)
 {
-  for (size_t i = 0; i < MEMORY / INIT_SIZE_BYTE; i++)
+  expandKeys(m_keccak + offset, R128(m_keys));
+}
+
+uint64_t CryptonightAESNI::mul128(uint64_t a, uint64_t b, uint64_t *hi)
+{
+  uint64_t t2[2];
+  __asm__("mulq %3\n\t" : "=d"(t2[0]), "=a"(t2[1]) : "%a"(a), "rm"(b) : "cc");
+  *hi = t2[0];
+  return t2[1];
+}
+
+void CryptonightAESNI::iteration(size_t total)
+{
+  m_speculated = false;
+  CryptonightAESNI *self = this;
+  lockstepIteration<1>(&self, total);
+}
+
+template <size_t N, bool PREFETCH>
+bool CryptonightAESNI::lockstepIteration(CryptonightAESNI *const *ctx, size_t total)
+{
+  uint8_t *l[N];
+  stack_type _a[N], _b[N], _c[N];
+
+  for (size_t w = 0; w < N; ++w)
+  {
+    auto tpl = ctx[w]->initAandB();
+    l[w]     = ctx[w]->m_scratchpad.get();
+    _a[w]    = _mm_load_si128(R128(std::get<0>(tpl).v));
+    _b[w]    = _mm_load_si128(R128(std::get<1>(tpl).v));
+  }
+
+  for (size_t done = 0; done < total; done += CANCEL_CHUNK)
   {
-    __m128i *keys = R128(m_keys);
-    __m128i *x    = R128(&m_scratchpad[i * INIT_SIZE_BYTE]);
-    for (size_t j = 0; j < INIT_SIZE_BLOCK; j++)
+    if (cancelled<N>(ctx)) return false;
+    const size_t chunk = total - done < CANCEL_CHUNK ? total - done : CANCEL_CHUNK;
+    for (size_t i = 0; i < chunk; ++i)
     {
-      __m128i d = _mm_loadu_si128(R128(m_keccak + 64 + j * AES_BLOCK_SIZE));
-      d         = _mm_xor_si128(d, *R128(x++));
-      for (size_t k = 0; k < 10; ++k)
+      uint32_t index0[N], index1[N];
+
+      // Issue all the dependent scratchpad reads first so they are in flight together
+      for (size_t w = 0; w < N; ++w)
+      {
+        index0[w] = _mm_cvtsi128_si32(_a[w]) & ((TOTALBLOCKS - 1) << 4);
+        _c[w]     = _mm_load_si128(R128(&l[w][index0[w]]));
+        _c[w]     = _mm_aesenc_si128(_c[w], _a[w]);
+      }
+
+      for (size_t w = 0; w < N; ++w)
       {
-        d = _mm_aesenc_si128(d, *R128(&keys[k]));
+        index1[w] = _mm_cvtsi128_si32(_c[w]) & ((TOTALBLOCKS - 1) << 4);
+        if (PREFETCH) __builtin_prefetch(&l[w][index1[w]]);
+        _b[w] = _mm_xor_si128(_b[w], _c[w]);
+        _mm_store_si128(R128(&l[w][index0[w]]), _b[w]);
+      }
+
+      for (size_t w = 0; w < N; ++w)
+      {
+        uint64_t *p = reinterpret_cast<uint64_t *>(&l[w][index1[w]]);
+
+        uint64_t t2[2];
+        __asm__("mulq %3\n\t" : "=d"(t2[0]), "=a"(t2[1]) : "%a"(_mm_cvtsi128_si64(_c[w])), "rm"(p[0]) : "cc");
+        _b[w] = _mm_load_si128(R128(p));
+
+        _a[w] = _mm_add_epi64(_a[w], _mm_loadu_si128(R128(t2)));
+
+        _mm_store_si128(R128(p), _a[w]);
+        _a[w] = _mm_xor_si128(_a[w], _b[w]);
+        _b[w] = _c[w];
       }
-      _mm_storeu_si128((R128(m_keccak + 64 + j * AES_BLOCK_SIZE)), d);
     }
   }
+  return true;
+}
+
+template <size_t N, bool PREFETCH>
+void CryptonightAESNI::calculateResults(CryptonightAESNI *const *ctx, const uint8_t *in, size_t len)
+{
+  initKeccaks<N>(ctx, in, len);
+
+  for (size_t w = 0; w < N; ++w)
+  {
+    __m128i keys[11];
+    ctx[w]->m_speculated = false;
+    expandKeys(ctx[w]->m_keccak, keys);
+    explode(ctx[w]->m_vaes, keys, ctx[w]->m_keccak, ctx[w]->m_scratchpad.get());
+  }
+
+  if (!lockstepIteration<N, PREFETCH>(ctx, ITER / 2)) return;
+
+  for (size_t w = 0; w < N; ++w)
+  {
+    __m128i keys[11];
+    expandKeys(ctx[w]->m_keccak + 32, keys);
+    implode(ctx[w]->m_vaes, keys, ctx[w]->m_scratchpad.get(), ctx[w]->m_keccak);
+  }
+
+  rerunKeccaks<N>(ctx);
+  finalizeResults<N>(ctx);
+}
+
+template <bool PREFETCH> array::type<uint8_t, 64> &CryptonightAESNI::hashNext(uint32_t nonce)
+{
+  __m128i keys[11], nextKeys[11];
+  uint8_t *pad = m_scratchpad.get();
+
+  if (m_speculated && m_speculatedNonce == nonce)
+  {
+    memcpy(m_keccak, m_nextKeccak, sizeof(m_keccak));
+  }
+  else
+  {
+    initKeccak(blobWithNonce(nonce), m_blobLen);
+    expandKeys(m_keccak, keys);
+    explode(m_vaes, keys, m_keccak, pad);
+  }
+
+  CryptonightAESNI *self = this;
+  if (!lockstepIteration<1, PREFETCH>(&self, ITER / 2))
+  {
+    m_speculated = false;
+    return result();
+  }
+
+  keccak1600(blobWithNonce(nonce + 1), m_blobLen, m_nextKeccak);
+  expandKeys(m_keccak + 32, keys);
+  expandKeys(m_nextKeccak, nextKeys);
+  implodeExplode(m_vaes, keys, nextKeys, m_keccak, m_nextKeccak, pad);
+  m_speculated      = true;
+  m_speculatedNonce = nonce + 1;
+
+  rerunKeccak();
+  return calculateResult();
+}
+
+template array::type<uint8_t, 64> &CryptonightAESNI::hashNext<true>(uint32_t);
+template array::type<uint8_t, 64> &CryptonightAESNI::hashNext<false>(uint32_t);
+
+array::type<uint8_t, 64> &CryptonightAESNI::hash(const uint8_t *in, size_t len)
+{
+  CryptonightAESNI *self = this;
+  calculateResults<1>(&self, in, len);
+  return result();
+}
+
+template void CryptonightAESNI::calculateResults<1, true>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<1, false>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<2, true>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<2, false>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<3, true>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<3, false>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<4, true>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<4, false>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<5, true>(CryptonightAESNI *const *, const uint8_t *, size_t);
+template void CryptonightAESNI::calculateResults<5, false>(CryptonightAESNI *const *, const uint8_t *, size_t);
+
+void CryptonightAESNI::explodeScratchPad()
+{
+  m_speculated = false;
+  explode(m_vaes, R128(m_keys), m_keccak, m_scratchpad.get());
+}
+
+void CryptonightAESNI::implodeScratchPad()
+{
+  m_speculated = false;
+  implode(m_vaes, R128(m_keys), m_scratchpad.get(), m_keccak);
 }
 
 static bool global_sigill = false;
-void sighandler(int signo, siginfo_t *si, void *data)
+static void sighandler(int signo, siginfo_t *si, void *data)
 {
   (void)signo;
   (void)si;
@@ -166,7 +337,7 @@ void sighandler(int signo, siginfo_t *si, void *data)
   global_sigill = true;
 }
 
-bool testAES()
+static bool testAES()
 {
   __m128i mt1;
   uint64_t t1[2] = {0};
@@ -186,3 +357,18 @@ bool CryptonightAESNI::detect()
   sigaction(SIGILL, &osa, &sa);
   return !global_sigill && r;
 }
+
+CryptonightVAES::CryptonightVAES()
+{
+  m_vaes = true;
+}
+
+CryptonightVAES::CryptonightVAES(const Scratchpad &scratchpad) : CryptonightAESNI(scratchpad)
+{
+  m_vaes = true;
+}
+
+bool CryptonightVAES::detect()
+{
+  return CryptonightAESNI::detect() && __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2");
+}
@@ -11,6 +11,7 @@
 
 namespace cryptonight
 {
+XMR_KERNEL_NAMESPACE_BEGIN
 
 /*!
  * Cast a value to an aligned 128bit vector type
@@ -20,12 +21,28 @@ template <typename T> __m128i *R128(T x)
   return reinterpret_cast<__m128i *>(x);
 }
 
+/*!
+ * Cast a const pointer to an aligned 128bit vector type
+ */
+template <typename T> const __m128i *R128(const T *x)
+{
+  return reinterpret_cast<const __m128i *>(x);
+}
+
 /*!
  * The AESNI extension of the Cryptonight algorithm
  */
 class alignas(16) CryptonightAESNI : public Cryptonight
 {
+protected:
+  //! The keccak state of the speculated nonce
+  alignas(16) uint8_t m_nextKeccak[200];
+  //! Whether the scratchpad is exploded and imploded with VAES
+  bool m_vaes = false;
+
 public:
+  using Cryptonight::Cryptonight;
+
   //! Our stack type
   using stack_type = __m128i;
 
@@ -43,11 +60,85 @@ public:
   //! Implode the scratchpad using AESNI
   void implodeScratchPad() override;
 
+  /*!
+   * Perform N iterations on several contexts in lockstep, the
+   * scratchpad reads of one context overlap with the others
+   * \tparam PREFETCH Whether to prefetch the next scratchpad line
+   * \param ctx   The contexts, each one with its own scratchpad
+   * \param total The number of iterations
+   * \return False if the hashes were aborted by the cancel flag
+   */
+  template <size_t N, bool PREFETCH = true> static bool lockstepIteration(CryptonightAESNI *const *ctx, size_t total);
+
+  /*!
+   * Calculate N results at once, interleaving the main loops
+   * \tparam PREFETCH Whether the main loop prefetches
+   * \param ctx The N contexts, one for each input
+   * \param in  The N input byte arrays, one after the other
+   * \param len The length of each of the arrays
+   */
+  template <size_t N, bool PREFETCH = true>
+  static void calculateResults(CryptonightAESNI *const *ctx, const uint8_t *in, size_t len);
+
+  /*!
+   * Calculate the result with the AESNI pipeline, all stages
+   * inlined and the round keys kept in registers
+   * \param in  The input byte array
+   * \param len The length of the array
+   * \return The calculated result
+   */
+  array::type<uint8_t, 64> &hash(const uint8_t *in, size_t len);
+
+  /*!
+   * Calculate the result for the stored blob with the given nonce.
+   * While imploding the scratchpad it is exploded again for nonce + 1
+   * in the same pass, which the next call uses if the nonce matches.
+   * \tparam PREFETCH Whether the main loop prefetches
+   * \param nonce The nonce
+   * \return The calculated result, the same as calculateResult gives
+   */
+  template <bool PREFETCH = true> array::type<uint8_t, 64> &hashNext(uint32_t nonce);
+
   //! Multiply two 64bit numbers for testing purposes
   static uint64_t mul128(uint64_t a, uint64_t b, uint64_t *hi);
 
   //! Detect whether AESNI exists on this machine
   static bool detect();
 };
+
+/*!
+ * The AESNI extension with the scratchpad explode and implode done by
+ * VAES, two blocks per instruction. Everything else is the same, so the
+ * static AESNI functions take these contexts as they are.
+ */
+class alignas(16) CryptonightVAES : public CryptonightAESNI
+{
+public:
+  //! Base constructor, selects the VAES explode and implode
+  CryptonightVAES();
+  //! Construct on a scratchpad of an arena, see Cryptonight
+  explicit CryptonightVAES(const Scratchpad &scratchpad);
+
+  /*!
+   * Calculate N results at once, see CryptonightAESNI::calculateResults
+   * \tparam PREFETCH Whether the main loop prefetches
+   * \param ctx The N contexts, one for each input
+   * \param in  The N input byte arrays, one after the other
+   * \param len The length of each of the arrays
+   */
+  template <size_t N, bool PREFETCH = true>
+  static void calculateResults(CryptonightVAES *const *ctx, const uint8_t *in, size_t len)
+  {
+    CryptonightAESNI *actx[N];
+    for (size_t i = 0; i < N; ++i)
+      actx[i] = ctx[i];
+    CryptonightAESNI::calculateResults<N, PREFETCH>(actx, in, len);
+  }
+
+  //! Detect whether VAES and AVX2 exist on this machine
+  static bool detect();
+};
+
+XMR_KERNEL_NAMESPACE_END
 }
 #endif  // CRYPTONIGHT_AESNI_HPP
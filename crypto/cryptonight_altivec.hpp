@@ -9,6 +9,8 @@ namespace cryptonight
 class alignas(16) CryptonightAltivec : public Cryptonight
 {
 public:
+  using Cryptonight::Cryptonight;
+
   void explodeScratchPad();
   void iteration(size_t total);
   void implodeScratchPad();
@@ -17,6 +17,8 @@ namespace cryptonight
 class alignas(16) CryptonightSparc : public Cryptonight
 {
 public:
+  using Cryptonight::Cryptonight;
+
   //! Our stack type
   struct stack_type
   {
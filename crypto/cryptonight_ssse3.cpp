@@ -0,0 +1,271 @@
+#include "cryptonight_ssse3.hpp"
+#include <string.h>
+#include <x86intrin.h>
+
+using namespace cryptonight;
+
+/*
+ * GF(2^8) is represented as GF(2^4)[y] / (y^2 + 2y + 2) with GF(2^4) as
+ * GF(2)[w] / (w^4 + w + 1), a byte i*y + k keeps i in the high nibble.
+ * Inverting i*y + k with the norm N = k^2 + 2ik + 2i^2 only needs unary
+ * GF(2^4) functions:
+ *   t1 = 1 / (1/i + 2/k) + (i + k) = N / (k + 2i)
+ *   t2 = 1 / (1/(i + k) + 2/k) + i = N / (3k + 2i)
+ * and 1/t1, 1/t2 are linear in the inverse, so the basis change back and
+ * the S-box affine map fold into one table per term. Division by zero
+ * gives 0x80, which pshufb turns into zero on the next lookup; this is
+ * exactly what the formulas need when i or k is zero. 0x63 is the S-box
+ * output of the single input (zero) that makes both t1 and t2 0x80.
+ */
+alignas(16) static const uint8_t k_iptILo[16] = {0x00, 0x00, 0x01, 0x01, 0x02, 0x02, 0x03, 0x03,
+                                                 0x02, 0x02, 0x03, 0x03, 0x00, 0x00, 0x01, 0x01};
+alignas(16) static const uint8_t k_iptIHi[16] = {0x00, 0x08, 0x0f, 0x07, 0x08, 0x00, 0x07, 0x0f,
+                                                 0x07, 0x0f, 0x08, 0x00, 0x0f, 0x07, 0x00, 0x08};
+alignas(16) static const uint8_t k_iptKLo[16] = {0x00, 0x01, 0x0c, 0x0d, 0x0d, 0x0c, 0x01, 0x00,
+                                                 0x07, 0x06, 0x0b, 0x0a, 0x0a, 0x0b, 0x06, 0x07};
+alignas(16) static const uint8_t k_iptKHi[16] = {0x00, 0x06, 0x0d, 0x0b, 0x0e, 0x08, 0x03, 0x05,
+                                                 0x07, 0x01, 0x0a, 0x0c, 0x09, 0x0f, 0x04, 0x02};
+//! 1/x in GF(2^4)
+alignas(16) static const uint8_t k_inv[16] = {0x80, 0x01, 0x09, 0x0e, 0x0d, 0x0b, 0x07, 0x06,
+                                              0x0f, 0x02, 0x0c, 0x05, 0x0a, 0x04, 0x03, 0x08};
+//! 2/x in GF(2^4)
+alignas(16) static const uint8_t k_inv2[16] = {0x80, 0x02, 0x01, 0x0f, 0x09, 0x05, 0x0e, 0x0c,
+                                               0x0d, 0x04, 0x0b, 0x0a, 0x07, 0x08, 0x06, 0x03};
+//! S-box output for t1 and t2, without the 0x63
+alignas(16) static const uint8_t k_sbT1[16] = {0x00, 0xcb, 0xd7, 0xb0, 0x21, 0x8d, 0x67, 0xac,
+                                               0x7b, 0x5a, 0xea, 0x3d, 0x46, 0xf6, 0x91, 0x1c};
+alignas(16) static const uint8_t k_sbT2[16] = {0x00, 0x9f, 0x61, 0x16, 0xc2, 0x2a, 0x77, 0xe8,
+                                               0x89, 0x4b, 0x5d, 0x3c, 0xb5, 0xa3, 0xd4, 0xfe};
+//! The same multiplied by 2 for MixColumns
+alignas(16) static const uint8_t k_sb2T1[16] = {0x00, 0x8d, 0xb5, 0x7b, 0x42, 0x01, 0xce, 0x43,
+                                                0xf6, 0xb4, 0xcf, 0x7a, 0x8c, 0xf7, 0x39, 0x38};
+alignas(16) static const uint8_t k_sb2T2[16] = {0x00, 0x25, 0xc2, 0x2c, 0x9f, 0x54, 0xee, 0xcb,
+                                                0x09, 0x96, 0xba, 0x78, 0x71, 0x5d, 0xb3, 0xe7};
+alignas(16) static const uint8_t k_shiftRows[16] = {0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11};
+//! Rotate each column up by one row
+alignas(16) static const uint8_t k_rotRow[16] = {1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12};
+
+static inline __m128i load(const uint8_t *table)
+{
+  return _mm_load_si128(reinterpret_cast<const __m128i *>(table));
+}
+
+static inline __m128i lookup(const uint8_t *table, __m128i index)
+{
+  return _mm_shuffle_epi8(load(table), index);
+}
+
+//! The t1 and t2 terms of the S-box of every byte of x
+static inline void sboxTerms(__m128i x, __m128i &t1, __m128i &t2)
+{
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+
+  __m128i lo = _mm_and_si128(x, nibble);
+  __m128i hi = _mm_and_si128(_mm_srli_epi32(x, 4), nibble);
+
+  __m128i i = _mm_xor_si128(lookup(k_iptILo, lo), lookup(k_iptIHi, hi));
+  __m128i k = _mm_xor_si128(lookup(k_iptKLo, lo), lookup(k_iptKHi, hi));
+  __m128i j = _mm_xor_si128(i, k);
+
+  __m128i ak  = lookup(k_inv2, k);
+  __m128i iak = _mm_xor_si128(lookup(k_inv, i), ak);
+  __m128i jak = _mm_xor_si128(lookup(k_inv, j), ak);
+  t1          = _mm_xor_si128(lookup(k_inv, iak), j);
+  t2          = _mm_xor_si128(lookup(k_inv, jak), i);
+}
+
+//! SubBytes on all 16 bytes
+static inline __m128i subBytes(__m128i x)
+{
+  __m128i t1, t2;
+  sboxTerms(x, t1, t2);
+  return _mm_xor_si128(_mm_xor_si128(lookup(k_sbT1, t1), lookup(k_sbT2, t2)), _mm_set1_epi8(0x63));
+}
+
+//! A single AES encryption round, the same as _mm_aesenc_si128
+static inline __m128i aesRound(__m128i x, __m128i key)
+{
+  // SubBytes works per byte so ShiftRows can go first
+  __m128i t1, t2;
+  sboxTerms(_mm_shuffle_epi8(x, load(k_shiftRows)), t1, t2);
+
+  __m128i s  = _mm_xor_si128(lookup(k_sbT1, t1), lookup(k_sbT2, t2));
+  __m128i s2 = _mm_xor_si128(lookup(k_sb2T1, t1), lookup(k_sb2T2, t2));
+
+  // MixColumns: 2*a0 + 3*a1 + a2 + a3, the 0x63 of every S-box output
+  // comes out of MixColumns unchanged so add it once at the end
+  const __m128i rot = load(k_rotRow);
+  __m128i r1        = _mm_shuffle_epi8(_mm_xor_si128(s, s2), rot);
+  __m128i r2        = _mm_shuffle_epi8(_mm_shuffle_epi8(s, rot), rot);
+  __m128i r3        = _mm_shuffle_epi8(r2, rot);
+  __m128i mc        = _mm_xor_si128(_mm_xor_si128(s2, r1), _mm_xor_si128(r2, r3));
+
+  return _mm_xor_si128(_mm_xor_si128(mc, _mm_set1_epi8(0x63)), key);
+}
+
+//! Run the 10 rounds on all the blocks of a line, the blocks are independent
+static inline void encryptLine(const __m128i *keys, __m128i *x)
+{
+  for (size_t k = 0; k < 10; ++k)
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      x[j] = aesRound(x[j], keys[k]);
+}
+
+//! Each word xored with all the words below it
+static inline __m128i prefixXor(__m128i x)
+{
+  x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+  x = _mm_xor_si128(x, _mm_slli_si128(x, 8));
+  return x;
+}
+
+/*!
+ * The AES-256 key expansion of the 32 key bytes, with the same S-box as
+ * the rounds so no table is read. Fills all n round keys of the schedule
+ * the way Cryptonight::initRoundKeys does.
+ */
+static inline void expandKeys(const uint8_t *key, uint8_t *out, size_t n)
+{
+  // RotWord of the last word and the last word itself, in every word
+  const __m128i rotLast = _mm_setr_epi8(13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12);
+  const __m128i last    = _mm_setr_epi8(12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15, 12, 13, 14, 15);
+  __m128i k0            = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+  __m128i k1            = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key + 16));
+  uint8_t rcon          = 1;
+
+  __m128i *keys = reinterpret_cast<__m128i *>(out);
+  keys[0]       = k0;
+  keys[1]       = k1;
+  for (size_t i = 2; i < n; i += 2)
+  {
+    __m128i t = _mm_shuffle_epi8(subBytes(k1), rotLast);
+    k0        = _mm_xor_si128(prefixXor(k0), _mm_xor_si128(t, _mm_set1_epi32(rcon)));
+    keys[i]   = k0;
+    rcon      = uint8_t((rcon << 1) ^ ((rcon >> 7) * 0x1b));
+
+    t           = _mm_shuffle_epi8(subBytes(k0), last);
+    k1          = _mm_xor_si128(prefixXor(k1), t);
+    keys[i + 1] = k1;
+  }
+}
+
+static inline void loadKeys(const uint8_t *m_keys, __m128i *keys)
+{
+  for (size_t k = 0; k < 10; ++k)
+    keys[k] = _mm_load_si128(reinterpret_cast<const __m128i *>(m_keys + k * Cryptonight::AES_BLOCK_SIZE));
+}
+
+static inline void explode(const __m128i *keys, const uint8_t *keccak, uint8_t *pad)
+{
+  __m128i x[Cryptonight::INIT_SIZE_BLOCK];
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    x[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE));
+
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; ++i)
+  {
+    encryptLine(keys, x);
+    __m128i *line = reinterpret_cast<__m128i *>(pad + i * Cryptonight::INIT_SIZE_BYTE);
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      _mm_store_si128(line + j, x[j]);
+  }
+}
+
+static inline void implode(const __m128i *keys, const uint8_t *pad, uint8_t *keccak)
+{
+  __m128i x[Cryptonight::INIT_SIZE_BLOCK];
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    x[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE));
+
+  for (size_t i = 0; i < Cryptonight::MEMORY / Cryptonight::INIT_SIZE_BYTE; ++i)
+  {
+    const __m128i *line = reinterpret_cast<const __m128i *>(pad + i * Cryptonight::INIT_SIZE_BYTE);
+    for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+      x[j] = _mm_xor_si128(x[j], _mm_load_si128(line + j));
+    encryptLine(keys, x);
+  }
+
+  for (size_t j = 0; j < Cryptonight::INIT_SIZE_BLOCK; ++j)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(keccak + 64 + j * Cryptonight::AES_BLOCK_SIZE), x[j]);
+}
+
+static inline void iterate(__m128i &a, __m128i &b, uint8_t *pad, size_t total)
+{
+  for (size_t i = 0; i < total; ++i)
+  {
+    uint32_t index0 = _mm_cvtsi128_si32(a) & ((Cryptonight::TOTALBLOCKS - 1) << 4);
+    __m128i c       = aesRound(_mm_load_si128(reinterpret_cast<__m128i *>(pad + index0)), a);
+
+    uint32_t index1 = _mm_cvtsi128_si32(c) & ((Cryptonight::TOTALBLOCKS - 1) << 4);
+    b               = _mm_xor_si128(b, c);
+    _mm_store_si128(reinterpret_cast<__m128i *>(pad + index0), b);
+
+    uint64_t *p = reinterpret_cast<uint64_t *>(pad + index1);
+    uint64_t t2[2];
+    __asm__("mulq %3\n\t" : "=d"(t2[0]), "=a"(t2[1]) : "%a"(_mm_cvtsi128_si64(c)), "rm"(p[0]) : "cc");
+    b = _mm_load_si128(reinterpret_cast<__m128i *>(p));
+
+    a = _mm_add_epi64(a, _mm_loadu_si128(reinterpret_cast<__m128i *>(t2)));
+    _mm_store_si128(reinterpret_cast<__m128i *>(p), a);
+    a = _mm_xor_si128(a, b);
+    b = c;
+  }
+}
+
+void CryptonightSSSE3::initRoundKeys(size_t offset)
+{
+  expandKeys(m_keccak + offset, m_keys, sizeof(m_keys) / AES_BLOCK_SIZE);
+}
+
+void CryptonightSSSE3::explodeScratchPad()
+{
+  __m128i keys[10];
+  loadKeys(m_keys, keys);
+  explode(keys, m_keccak, m_scratchpad.get());
+}
+
+void CryptonightSSSE3::iteration(size_t total)
+{
+  auto tpl = initAandB();
+  __m128i a = _mm_load_si128(reinterpret_cast<__m128i *>(std::get<0>(tpl).v));
+  __m128i b = _mm_load_si128(reinterpret_cast<__m128i *>(std::get<1>(tpl).v));
+  for (size_t done = 0; done < total; done += CANCEL_CHUNK)
+  {
+    if (cancelled()) return;
+    iterate(a, b, m_scratchpad.get(), total - done < CANCEL_CHUNK ? total - done : CANCEL_CHUNK);
+  }
+}
+
+void CryptonightSSSE3::implodeScratchPad()
+{
+  __m128i keys[10];
+  loadKeys(m_keys, keys);
+  implode(keys, m_scratchpad.get(), m_keccak);
+}
+
+array::type<uint8_t, 64> &CryptonightSSSE3::hash(const uint8_t *in, size_t len)
+{
+  __m128i keys[10];
+  m_speculated = false;
+
+  initKeccak(in, len);
+  CryptonightSSSE3::initRoundKeys(0);
+  loadKeys(m_keys, keys);
+  explode(keys, m_keccak, m_scratchpad.get());
+  CryptonightSSSE3::iteration(ITER / 2);
+  if (m_aborted) return result();
+  CryptonightSSSE3::initRoundKeys(32);
+  loadKeys(m_keys, keys);
+  implode(keys, m_scratchpad.get(), m_keccak);
+  rerunKeccak();
+  return calculateResult();
+}
+
+array::type<uint8_t, 64> &CryptonightSSSE3::hashNext(uint32_t nonce)
+{
+  return hash(blobWithNonce(nonce), m_blobLen);
+}
+
+bool CryptonightSSSE3::detect()
+{
+  return __builtin_cpu_supports("ssse3");
+}
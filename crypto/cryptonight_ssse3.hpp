@@ -0,0 +1,61 @@
+/*!
+ * @file cryptonight_ssse3.hpp
+ * An extension of the base cryptonight class
+ * to compute AES with SSSE3 byte shuffles on x86 CPUs without AESNI
+ */
+#ifndef CRYPTONIGHT_SSSE3_HPP
+#define CRYPTONIGHT_SSSE3_HPP
+
+#include <cryptonight.hpp>
+#include <x86intrin.h>
+
+namespace cryptonight
+{
+XMR_KERNEL_NAMESPACE_BEGIN
+
+/*!
+ * The SSSE3 extension of the Cryptonight algorithm. The AES rounds
+ * are table free: the S-box is an inversion in GF((2^4)^2) where
+ * every GF(2^4) operation is a 16 entry pshufb lookup, so nothing
+ * competes with the scratchpad for the cache and the timing does
+ * not depend on the data. The key expansion uses the same S-box.
+ */
+class alignas(16) CryptonightSSSE3 : public Cryptonight
+{
+public:
+  using Cryptonight::Cryptonight;
+
+  //! Our stack type
+  using stack_type = __m128i;
+
+  //! Expand the round keys with the same table free S-box
+  void initRoundKeys(size_t offset) override;
+  //! Explode the scratchpad using SSSE3
+  void explodeScratchPad() override;
+  //! Perform iterations using SSSE3
+  void iteration(size_t total) override;
+  //! Implode the scratchpad using SSSE3
+  void implodeScratchPad() override;
+
+  /*!
+   * Calculate the result with all the stages inlined
+   * \param in  The input byte array
+   * \param len The length of the array
+   * \return The calculated result
+   */
+  array::type<uint8_t, 64> &hash(const uint8_t *in, size_t len);
+
+  /*!
+   * Calculate the result for the stored blob with the given nonce
+   * \param nonce The nonce
+   * \return The calculated result
+   */
+  array::type<uint8_t, 64> &hashNext(uint32_t nonce);
+
+  //! Detect whether SSSE3 exists on this machine
+  static bool detect();
+};
+
+XMR_KERNEL_NAMESPACE_END
+}
+#endif  // CRYPTONIGHT_SSSE3_HPP
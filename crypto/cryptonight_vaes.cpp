@@ -0,0 +1,96 @@
+// cryptonight_vaes.cpp
+// The explode and implode loops of cryptonight_aesni.cpp with VAES. The
+// eight blocks of a line sit in four 256 bit registers, so each round of
+// a line takes four vaesenc instead of eight aesenc. Built with -mvaes
+// -mavx2 and only called through CryptonightVAES after checking the CPU
+// supports it.
+
+#include "cryptonight_vaes.hpp"
+
+using namespace cryptonight;
+
+//! The bytes of one line of the scratchpad
+static const size_t LINE_SIZE = 128;
+//! The registers of one line
+static const size_t LINE_REGS = LINE_SIZE / sizeof(__m256i);
+
+//! Put every round key in both halves of a register
+static inline void broadcastKeys(const __m128i *keys, __m256i *k)
+{
+  for (size_t r = 0; r < 10; ++r)
+    k[r] = _mm256_broadcastsi128_si256(keys[r]);
+}
+
+static inline void loadLine(const uint8_t *src, __m256i *x)
+{
+  for (size_t j = 0; j < LINE_REGS; ++j)
+    x[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src) + j);
+}
+
+static inline void storeLine(uint8_t *dst, const __m256i *x)
+{
+  for (size_t j = 0; j < LINE_REGS; ++j)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst) + j, x[j]);
+}
+
+void vaes::explode(const __m128i *keys, const uint8_t *keccak, uint8_t *pad, size_t size)
+{
+  __m256i k[10], x[LINE_REGS];
+  broadcastKeys(keys, k);
+  loadLine(keccak + 64, x);
+
+  for (size_t i = 0; i < size; i += LINE_SIZE)
+  {
+    for (size_t r = 0; r < 10; ++r)
+      for (size_t j = 0; j < LINE_REGS; ++j)
+        x[j] = _mm256_aesenc_epi128(x[j], k[r]);
+    storeLine(pad + i, x);
+  }
+}
+
+void vaes::implode(const __m128i *keys, const uint8_t *pad, uint8_t *keccak, size_t size)
+{
+  __m256i k[10], x[LINE_REGS];
+  broadcastKeys(keys, k);
+  loadLine(keccak + 64, x);
+
+  for (size_t i = 0; i < size; i += LINE_SIZE)
+  {
+    const __m256i *line = reinterpret_cast<const __m256i *>(pad + i);
+    for (size_t j = 0; j < LINE_REGS; ++j)
+      x[j] = _mm256_xor_si256(x[j], _mm256_loadu_si256(line + j));
+    for (size_t r = 0; r < 10; ++r)
+      for (size_t j = 0; j < LINE_REGS; ++j)
+        x[j] = _mm256_aesenc_epi128(x[j], k[r]);
+  }
+
+  storeLine(keccak + 64, x);
+}
+
+void vaes::implodeExplode(const __m128i *keys, const __m128i *nextKeys, uint8_t *keccak, const uint8_t *nextKeccak,
+                          uint8_t *pad, size_t size)
+{
+  __m256i k[10], nk[10], x[LINE_REGS], y[LINE_REGS];
+  broadcastKeys(keys, k);
+  broadcastKeys(nextKeys, nk);
+  loadLine(keccak + 64, x);
+  loadLine(nextKeccak + 64, y);
+
+  for (size_t i = 0; i < size; i += LINE_SIZE)
+  {
+    __m256i *line = reinterpret_cast<__m256i *>(pad + i);
+    for (size_t j = 0; j < LINE_REGS; ++j)
+      x[j] = _mm256_xor_si256(x[j], _mm256_loadu_si256(line + j));
+    for (size_t r = 0; r < 10; ++r)
+    {
+      for (size_t j = 0; j < LINE_REGS; ++j)
+      {
+        x[j] = _mm256_aesenc_epi128(x[j], k[r]);
+        y[j] = _mm256_aesenc_epi128(y[j], nk[r]);
+      }
+    }
+    storeLine(pad + i, y);
+  }
+
+  storeLine(keccak + 64, x);
+}
@@ -0,0 +1,56 @@
+/*!
+ * @file cryptonight_vaes.hpp
+ * The scratchpad explode and implode of the AESNI backend with VAES,
+ * two AES blocks per 256 bit register. Only call these after checking
+ * the CPU supports VAES and AVX2, see CryptonightVAES::detect.
+ *
+ * This header deliberately pulls in nothing of cryptonight.hpp, so no
+ * inline function of the shared classes is ever compiled with -mavx2.
+ */
+#ifndef CRYPTONIGHT_VAES_HPP
+#define CRYPTONIGHT_VAES_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <x86intrin.h>
+#include "kernel_level.h"
+
+namespace cryptonight
+{
+XMR_KERNEL_NAMESPACE_BEGIN
+namespace vaes
+{
+/*!
+ * Explode the scratchpad
+ * \param keys   The 10 round keys
+ * \param keccak The Keccak state, the first line comes from bytes 64 to 191
+ * \param pad    The scratchpad
+ * \param size   The size of the scratchpad, a multiple of 128 bytes
+ */
+void explode(const __m128i *keys, const uint8_t *keccak, uint8_t *pad, size_t size);
+
+/*!
+ * Implode the scratchpad into bytes 64 to 191 of the Keccak state
+ * \param keys   The 10 round keys
+ * \param pad    The scratchpad
+ * \param keccak The Keccak state
+ * \param size   The size of the scratchpad, a multiple of 128 bytes
+ */
+void implode(const __m128i *keys, const uint8_t *pad, uint8_t *keccak, size_t size);
+
+/*!
+ * Implode the scratchpad and explode it again for the next hash in the
+ * same pass
+ * \param keys       The 10 round keys of the implode
+ * \param nextKeys   The 10 round keys of the explode
+ * \param keccak     The Keccak state to implode into
+ * \param nextKeccak The Keccak state to explode from
+ * \param pad        The scratchpad
+ * \param size       The size of the scratchpad, a multiple of 128 bytes
+ */
+void implodeExplode(const __m128i *keys, const __m128i *nextKeys, uint8_t *keccak, const uint8_t *nextKeccak,
+                    uint8_t *pad, size_t size);
+}
+XMR_KERNEL_NAMESPACE_END
+}
+#endif  // CRYPTONIGHT_VAES_HPP
@@ -39,6 +39,7 @@ typedef crypto_uint32 uint32_t;
 typedef crypto_uint64 uint64_t;
 */
 #include <stdint.h>
+#include "kernel_level.h"
 
 /* some sizes (number of bytes) */
 #define ROWS 8
@@ -79,6 +80,11 @@ void Final(hashState*, BitSequence*); */
 void groestl(const BitSequence*, DataLength, BitSequence*);
 /* NIST API end   */
 
+#ifdef __x86_64
+/* the same with AES-NI and SSSE3, check the CPU before calling it */
+void groestl_aesni(const BitSequence*, DataLength, BitSequence*);
+#endif
+
 /*
 int crypto_hash(unsigned char *out,
 		const unsigned char *in,
@@ -0,0 +1,173 @@
+// groestl_aesni.cpp
+// Groestl-256 with AES-NI and SSSE3. Built with -maes -mssse3 and only
+// called through Cryptonight::finalizeResult() for contexts that run on a
+// hardware AES backend.
+//
+// P and Q run side by side: register i holds row i of P in the low half
+// and row i of Q in the high half. ShiftBytes then stays inside every
+// register, a single pshufb that also undoes the AES ShiftRows, so
+// aesenclast with a zero key is just the S-box.
+
+#include <x86intrin.h>
+#include <string.h>
+
+#include "groestl.h"
+
+// ShiftBytes of P (low half) and Q (high half) for every row, followed
+// by the inverse of the ShiftRows inside aesenclast
+alignas(16) static const uint8_t shift_masks[ROWS][16] =
+{
+    {  0, 14, 11,  7,  4,  1, 15, 12,  9,  5,  2,  8, 13, 10,  6,  3 },
+    {  1,  8, 13,  0,  5,  2,  9, 14, 11,  6,  3, 10, 15, 12,  7,  4 },
+    {  2, 10, 15,  1,  6,  3, 11,  8, 13,  7,  4, 12,  9, 14,  0,  5 },
+    {  3, 12,  9,  2,  7,  4, 13, 10, 15,  0,  5, 14, 11,  8,  1,  6 },
+    {  4, 13, 10,  3,  0,  5, 14, 11,  8,  1,  6, 15, 12,  9,  2,  7 },
+    {  5, 15, 12,  4,  1,  6,  8, 13, 10,  2,  7,  9, 14, 11,  3,  0 },
+    {  6,  9, 14,  5,  2,  7, 10, 15, 12,  3,  0, 11,  8, 13,  4,  1 },
+    {  7, 11,  8,  6,  3,  0, 12,  9, 14,  4,  1, 13, 10, 15,  5,  2 },
+};
+
+// interleave the two columns of a register byte by byte
+alignas(16) static const uint8_t interleave_mask[16] =
+{
+    0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15
+};
+
+// the column numbers shifted into the high nibble, the base of the
+// round constants
+static const uint64_t column_consts = 0x7060504030201000ull;
+
+static inline __m128i mul2(__m128i x)
+{
+    __m128i carry = _mm_and_si128(_mm_cmpgt_epi8(_mm_setzero_si128(), x), _mm_set1_epi8(0x1b));
+    return _mm_xor_si128(_mm_add_epi8(x, x), carry);
+}
+
+// both permutations, ten rounds
+static void permute(__m128i a[ROWS])
+{
+    const __m128i q_ones = _mm_set_epi64x(-1, 0);
+    __m128i b[ROWS];
+    int i, r;
+
+    for (r = 0; r < ROUNDS512; r++) {
+        const uint64_t rc = column_consts ^ (0x0101010101010101ull * r);
+
+        // AddRoundConstant
+        a[0] = _mm_xor_si128(a[0], _mm_set_epi64x(-1, rc));
+        for (i = 1; i < ROWS - 1; i++)
+            a[i] = _mm_xor_si128(a[i], q_ones);
+        a[7] = _mm_xor_si128(a[7], _mm_set_epi64x(~rc, 0));
+
+        // SubBytes and ShiftBytes
+        for (i = 0; i < ROWS; i++) {
+            b[i] = _mm_shuffle_epi8(a[i], _mm_load_si128(reinterpret_cast<const __m128i *>(shift_masks[i])));
+            b[i] = _mm_aesenclast_si128(b[i], _mm_setzero_si128());
+        }
+
+        // MixBytes, the circulant (2,2,3,4,5,3,5,7) split into its
+        // 1, 2 and 4 parts: a_i = x ^ 2 * (y ^ 2 * z)
+        for (i = 0; i < ROWS; i++) {
+            const __m128i &b0 = b[i], &b1 = b[(i + 1) % 8], &b2 = b[(i + 2) % 8], &b3 = b[(i + 3) % 8];
+            const __m128i &b4 = b[(i + 4) % 8], &b5 = b[(i + 5) % 8], &b6 = b[(i + 6) % 8], &b7 = b[(i + 7) % 8];
+            __m128i x = _mm_xor_si128(_mm_xor_si128(b2, b4), _mm_xor_si128(_mm_xor_si128(b5, b6), b7));
+            __m128i y = _mm_xor_si128(_mm_xor_si128(b0, b1), _mm_xor_si128(_mm_xor_si128(b2, b5), b7));
+            __m128i z = _mm_xor_si128(_mm_xor_si128(b3, b4), _mm_xor_si128(b6, b7));
+            a[i] = _mm_xor_si128(x, mul2(_mm_xor_si128(y, mul2(z))));
+        }
+    }
+}
+
+// load a 64 byte block as row pairs, register k holds rows 2k and 2k+1
+static inline void loadRows(const uint8_t *in, __m128i m[4])
+{
+    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i *>(interleave_mask));
+    __m128i c[4], lo[2], hi[2];
+    int k;
+
+    for (k = 0; k < 4; k++)
+        c[k] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in) + k), mask);
+
+    lo[0] = _mm_unpacklo_epi16(c[0], c[1]);
+    hi[0] = _mm_unpackhi_epi16(c[0], c[1]);
+    lo[1] = _mm_unpacklo_epi16(c[2], c[3]);
+    hi[1] = _mm_unpackhi_epi16(c[2], c[3]);
+
+    m[0] = _mm_unpacklo_epi32(lo[0], lo[1]);
+    m[1] = _mm_unpackhi_epi32(lo[0], lo[1]);
+    m[2] = _mm_unpacklo_epi32(hi[0], hi[1]);
+    m[3] = _mm_unpackhi_epi32(hi[0], hi[1]);
+}
+
+// h <- P(h ^ m) ^ Q(m) ^ h
+static void compress(__m128i h[4], const uint8_t *block)
+{
+    __m128i m[4], a[ROWS];
+    int k;
+
+    loadRows(block, m);
+    for (k = 0; k < 4; k++) {
+        __m128i p = _mm_xor_si128(h[k], m[k]);
+        a[2 * k] = _mm_unpacklo_epi64(p, m[k]);
+        a[2 * k + 1] = _mm_unpackhi_epi64(p, m[k]);
+    }
+
+    permute(a);
+
+    for (k = 0; k < 4; k++) {
+        __m128i p = _mm_unpacklo_epi64(a[2 * k], a[2 * k + 1]);
+        __m128i q = _mm_unpackhi_epi64(a[2 * k], a[2 * k + 1]);
+        h[k] = _mm_xor_si128(h[k], _mm_xor_si128(p, q));
+    }
+}
+
+void groestl_aesni(const BitSequence *data, DataLength databitlen, BitSequence *hashval)
+{
+    // only whole bytes here, the rare bit lengths go the long way
+    if (databitlen % 8 != 0) {
+        groestl(data, databitlen, hashval);
+        return;
+    }
+
+    size_t len = databitlen / 8;
+    size_t blocks = len / SIZE512;
+    size_t rest = len % SIZE512;
+    uint8_t pad[2 * SIZE512];
+    size_t padlen = rest + 1 <= SIZE512 - LENGTHFIELDLEN ? SIZE512 : 2 * SIZE512;
+    uint64_t count = blocks + padlen / SIZE512;
+    __m128i h[4], a[ROWS];
+    int i, k;
+
+    // the initial value is the output length in the last column
+    h[0] = h[1] = h[2] = _mm_setzero_si128();
+    h[3] = _mm_set_epi64x(0, uint64_t(HASH_BIT_LEN >> 8) << 56);
+
+    for (; blocks > 0; blocks--, data += SIZE512)
+        compress(h, data);
+
+    memcpy(pad, data, rest);
+    pad[rest] = 0x80;
+    memset(pad + rest + 1, 0, padlen - rest - 1);
+    for (i = 1; i <= LENGTHFIELDLEN; i++, count >>= 8)
+        pad[padlen - i] = uint8_t(count);
+
+    for (k = 0; k < int(padlen); k += SIZE512)
+        compress(h, pad + k);
+
+    // output transformation, P(h) ^ h, the Q half is left unused
+    for (k = 0; k < 4; k++) {
+        a[2 * k] = _mm_unpacklo_epi64(h[k], h[k]);
+        a[2 * k + 1] = _mm_unpackhi_epi64(h[k], h[k]);
+    }
+    permute(a);
+
+    alignas(16) uint8_t rows[ROWS][8];
+    for (k = 0; k < 4; k++) {
+        __m128i p = _mm_unpacklo_epi64(a[2 * k], a[2 * k + 1]);
+        _mm_store_si128(reinterpret_cast<__m128i *>(rows[2 * k]), _mm_xor_si128(h[k], p));
+    }
+
+    // the hash is the last four columns
+    for (i = 0; i < HASH_BIT_LEN / 8; i++)
+        hashval[i] = rows[i % ROWS][COLS512 / 2 + i / ROWS];
+}
@@ -214,15 +214,19 @@ static void E8(hashState *state)
 static void F8(hashState *state)
 {
       uint64  i;
+      uint64  m[8];
+
+      /*copy the message block out of the byte buffer, reading it through a uint64 pointer breaks strict aliasing*/
+      memcpy(m, state->buffer, 64);
 
       /*xor the 512-bit message with the fist half of the 1024-bit hash state*/
-      for (i = 0; i < 8; i++)  state->x[i >> 1][i & 1] ^= ((uint64*)state->buffer)[i];
+      for (i = 0; i < 8; i++)  state->x[i >> 1][i & 1] ^= m[i];
 
       /*the bijective function E8 */
       E8(state);
 
       /*xor the 512-bit message with the second half of the 1024-bit hash state*/
-      for (i = 0; i < 8; i++)  state->x[(8+i) >> 1][(8+i) & 1] ^= ((uint64*)state->buffer)[i];
+      for (i = 0; i < 8; i++)  state->x[(8+i) >> 1][(8+i) & 1] ^= m[i];
 }
 
 /*before hashing a message, initialize the hash state as H0 */
@@ -14,8 +14,15 @@
 */
 #pragma once
 
+#include "kernel_level.h"
+
 typedef unsigned char BitSequence;
 typedef unsigned long long DataLength;
 typedef enum {SUCCESS = 0, FAIL = 1, BAD_HASHLEN = 2} JHHashReturn;
 
 JHHashReturn jh_hash(int hashbitlen, const BitSequence *data, DataLength databitlen, BitSequence *hashval);
+
+#ifdef __SSE2__
+/* the same with the E8 permutation in SSE2 registers */
+JHHashReturn jh_hash_sse2(int hashbitlen, const BitSequence *data, DataLength databitlen, BitSequence *hashval);
+#endif
@@ -0,0 +1,157 @@
+/*The bitslice implementation of JH-256 with SSE2
+
+   The same E8 as jh.c, but every 128-bit row of the state lives in one
+   SSE2 register, so the two 64-bit halves that jh.c handles one after
+   the other in its loop over i are done by the same instructions, and
+   the state stays in registers from the first block to the last.
+
+   Only byte aligned 256-bit hashes are done here, everything else is
+   passed on to jh_hash.
+*/
+
+#include "jh.h"
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+/*the initial hash value and the round constants, from jh.c*/
+extern const unsigned char JH256_H0[128];
+extern const unsigned char E8_bitslice_roundconstant[42][32];
+
+/*swapping bit 2i with bit 2i+1 of both 64-bit halves of x, and so on for the wider swaps*/
+#define SWAP_MASKED(x,mask,n) (x) = _mm_or_si128(_mm_slli_epi64(_mm_and_si128((x), _mm_set1_epi64x(mask)), (n)), \
+                                                 _mm_and_si128(_mm_srli_epi64((x), (n)), _mm_set1_epi64x(mask)));
+#define SWAP1(x)   SWAP_MASKED(x, 0x5555555555555555LL, 1)
+#define SWAP2(x)   SWAP_MASKED(x, 0x3333333333333333LL, 2)
+#define SWAP4(x)   SWAP_MASKED(x, 0x0f0f0f0f0f0f0f0fLL, 4)
+#define SWAP8(x)   (x) = _mm_or_si128(_mm_slli_epi16((x), 8), _mm_srli_epi16((x), 8));
+#define SWAP16(x)  (x) = _mm_shufflehi_epi16(_mm_shufflelo_epi16((x), 0xb1), 0xb1);
+#define SWAP32(x)  (x) = _mm_shuffle_epi32((x), 0xb1);
+/*swapping the two 64-bit halves of x, the last swapping layer of the seven*/
+#define SWAP64(x)  (x) = _mm_shuffle_epi32((x), 0x4e);
+
+#define XOR(a,b)    _mm_xor_si128((a), (b))
+#define AND(a,b)    _mm_and_si128((a), (b))
+#define ANDNOT(a,b) _mm_andnot_si128((a), (b))
+#define OR(a,b)     _mm_or_si128((a), (b))
+
+/*The MDS transform*/
+#define L(m0,m1,m2,m3,m4,m5,m6,m7) \
+      (m4) = XOR((m4), (m1));          \
+      (m5) = XOR((m5), (m2));          \
+      (m6) = XOR((m6), XOR((m0), (m3))); \
+      (m7) = XOR((m7), (m0));          \
+      (m0) = XOR((m0), (m5));          \
+      (m1) = XOR((m1), (m6));          \
+      (m2) = XOR((m2), XOR((m4), (m7))); \
+      (m3) = XOR((m3), (m4));
+
+/*The two Sboxes of jh.c, ANDNOT(a,b) being (~a) & b*/
+#define SS(m0,m1,m2,m3,m4,m5,m6,m7,cc0,cc1)   \
+      m3  = XOR(m3, ones);              \
+      m7  = XOR(m7, ones);              \
+      m0  = XOR(m0, ANDNOT(m2, cc0));   \
+      m4  = XOR(m4, ANDNOT(m6, cc1));   \
+      temp0 = XOR(cc0, AND(m0, m1));    \
+      temp1 = XOR(cc1, AND(m4, m5));    \
+      m0  = XOR(m0, AND(m2, m3));       \
+      m4  = XOR(m4, AND(m6, m7));       \
+      m3  = XOR(m3, ANDNOT(m1, m2));    \
+      m7  = XOR(m7, ANDNOT(m5, m6));    \
+      m1  = XOR(m1, AND(m0, m2));       \
+      m5  = XOR(m5, AND(m4, m6));       \
+      m2  = XOR(m2, ANDNOT(m3, m0));    \
+      m6  = XOR(m6, ANDNOT(m7, m4));    \
+      m0  = XOR(m0, OR(m1, m3));        \
+      m4  = XOR(m4, OR(m5, m7));        \
+      m3  = XOR(m3, AND(m1, m2));       \
+      m7  = XOR(m7, AND(m5, m6));       \
+      m1  = XOR(m1, AND(temp0, m0));    \
+      m5  = XOR(m5, AND(temp1, m4));    \
+      m2  = XOR(m2, temp0);             \
+      m6  = XOR(m6, temp1);
+
+/*round r: Sbox, MDS and the given swapping layer*/
+#define ROUND(r,SWAP)                                                                 \
+      cc0 = _mm_loadu_si128((const __m128i *)E8_bitslice_roundconstant[r]);          \
+      cc1 = _mm_loadu_si128((const __m128i *)(E8_bitslice_roundconstant[r] + 16));   \
+      SS(x0,x2,x4,x6,x1,x3,x5,x7,cc0,cc1);                                          \
+      L(x0,x2,x4,x6,x1,x3,x5,x7);                                                   \
+      SWAP(x1); SWAP(x3); SWAP(x5); SWAP(x7);
+
+/*The bijective function E8, in bitslice form*/
+static inline void E8(__m128i x[8])
+{
+      const __m128i ones = _mm_set1_epi32(-1);
+      __m128i x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3], x4 = x[4], x5 = x[5], x6 = x[6], x7 = x[7];
+      __m128i cc0, cc1, temp0, temp1;
+      int roundnumber;
+
+      for (roundnumber = 0; roundnumber < 42; roundnumber = roundnumber+7) {
+            ROUND(roundnumber+0, SWAP1);
+            ROUND(roundnumber+1, SWAP2);
+            ROUND(roundnumber+2, SWAP4);
+            ROUND(roundnumber+3, SWAP8);
+            ROUND(roundnumber+4, SWAP16);
+            ROUND(roundnumber+5, SWAP32);
+            ROUND(roundnumber+6, SWAP64);
+      }
+
+      x[0] = x0; x[1] = x1; x[2] = x2; x[3] = x3; x[4] = x4; x[5] = x5; x[6] = x6; x[7] = x7;
+}
+
+/*The compression function F8 */
+static inline void F8(__m128i x[8], const unsigned char *block)
+{
+      __m128i m[4];
+      int i;
+
+      /*xor the 512-bit message with the fist half of the 1024-bit hash state*/
+      for (i = 0; i < 4; i++) {
+            m[i] = _mm_loadu_si128((const __m128i *)block + i);
+            x[i] = XOR(x[i], m[i]);
+      }
+
+      /*the bijective function E8 */
+      E8(x);
+
+      /*xor the 512-bit message with the second half of the 1024-bit hash state*/
+      for (i = 0; i < 4; i++)  x[4+i] = XOR(x[4+i], m[i]);
+}
+
+JHHashReturn jh_hash_sse2(int hashbitlen, const BitSequence *data, DataLength databitlen, BitSequence *hashval)
+{
+      unsigned char buffer[128];
+      __m128i x[8];
+      size_t rest, padlen, i;
+
+      if (hashbitlen != 256 || (databitlen & 7) != 0)
+            return jh_hash(hashbitlen, data, databitlen, hashval);
+
+      for (i = 0; i < 8; i++)  x[i] = _mm_loadu_si128((const __m128i *)JH256_H0 + i);
+
+      /*hash the full message blocks*/
+      for (rest = databitlen >> 3; rest >= 64; rest -= 64, data += 64)
+            F8(x, data);
+
+      /*a message that ends on a block boundary is padded with one block, anything else with two*/
+      padlen = rest == 0 ? 64 : 128;
+      memcpy(buffer, data, rest);
+      memset(buffer + rest, 0, padlen - rest);
+      buffer[rest] = 0x80;
+      for (i = 1; i <= 8; i++, databitlen >>= 8)  buffer[padlen - i] = databitlen & 0xff;
+
+      for (i = 0; i < padlen; i += 64)
+            F8(x, buffer + i);
+
+      /*the digest is the last 256 bits of the state*/
+      _mm_storeu_si128((__m128i *)hashval, x[6]);
+      _mm_storeu_si128((__m128i *)hashval + 1, x[7]);
+
+      return(SUCCESS);
+}
+
+#endif
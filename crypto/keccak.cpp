@@ -37,9 +37,9 @@ const int keccakf_piln[24] =
     15, 23, 19, 13, 12, 2, 20, 14, 22, 9,  6,  1 
 };
 
-// update the state with given number of rounds
+// update the state with given number of rounds, the plain loop version
 
-void keccakf(uint64_t st[25], int rounds)
+void keccakf_ref(uint64_t st[25], int rounds)
 {
     int i, j, round;
     uint64_t t, bc[5];
@@ -78,6 +78,107 @@ void keccakf(uint64_t st[25], int rounds)
     }
 }
 
+// The lanes kept complemented between rounds, this turns all but one
+// NOT per row of Chi into an OR
+
+static const uint64_t keccakf_compl[25] =
+{
+    0, ~0ull, ~0ull, 0, 0, 0, 0, 0, ~0ull, 0, 0, 0, ~0ull,
+    0, 0, 0, 0, ~0ull, 0, 0, ~0ull, 0, 0, 0, 0
+};
+
+// update the state with given number of rounds, unrolled so the state
+// stays in registers
+
+void keccakf(uint64_t st[25], int rounds)
+{
+    uint64_t a[25], b[25], c[5], d[5], n;
+    int i, round;
+
+    for (i = 0; i < 25; i++)
+        a[i] = st[i] ^ keccakf_compl[i];
+
+    for (round = 0; round < rounds; round++) {
+
+        // Theta
+        c[0] = a[0] ^ a[5] ^ a[10] ^ a[15] ^ a[20];
+        c[1] = a[1] ^ a[6] ^ a[11] ^ a[16] ^ a[21];
+        c[2] = a[2] ^ a[7] ^ a[12] ^ a[17] ^ a[22];
+        c[3] = a[3] ^ a[8] ^ a[13] ^ a[18] ^ a[23];
+        c[4] = a[4] ^ a[9] ^ a[14] ^ a[19] ^ a[24];
+        d[0] = c[4] ^ ROTL64(c[1], 1);
+        d[1] = c[0] ^ ROTL64(c[2], 1);
+        d[2] = c[1] ^ ROTL64(c[3], 1);
+        d[3] = c[2] ^ ROTL64(c[4], 1);
+        d[4] = c[3] ^ ROTL64(c[0], 1);
+
+        // Rho Pi
+        b[ 0] = a[ 0] ^ d[0];
+        b[ 1] = ROTL64(a[ 6] ^ d[1], 44);
+        b[ 2] = ROTL64(a[12] ^ d[2], 43);
+        b[ 3] = ROTL64(a[18] ^ d[3], 21);
+        b[ 4] = ROTL64(a[24] ^ d[4], 14);
+        b[ 5] = ROTL64(a[ 3] ^ d[3], 28);
+        b[ 6] = ROTL64(a[ 9] ^ d[4], 20);
+        b[ 7] = ROTL64(a[10] ^ d[0],  3);
+        b[ 8] = ROTL64(a[16] ^ d[1], 45);
+        b[ 9] = ROTL64(a[22] ^ d[2], 61);
+        b[10] = ROTL64(a[ 1] ^ d[1],  1);
+        b[11] = ROTL64(a[ 7] ^ d[2],  6);
+        b[12] = ROTL64(a[13] ^ d[3], 25);
+        b[13] = ROTL64(a[19] ^ d[4],  8);
+        b[14] = ROTL64(a[20] ^ d[0], 18);
+        b[15] = ROTL64(a[ 4] ^ d[4], 27);
+        b[16] = ROTL64(a[ 5] ^ d[0], 36);
+        b[17] = ROTL64(a[11] ^ d[1], 10);
+        b[18] = ROTL64(a[17] ^ d[2], 15);
+        b[19] = ROTL64(a[23] ^ d[3], 56);
+        b[20] = ROTL64(a[ 2] ^ d[2], 62);
+        b[21] = ROTL64(a[ 8] ^ d[3], 55);
+        b[22] = ROTL64(a[14] ^ d[4], 39);
+        b[23] = ROTL64(a[15] ^ d[0], 41);
+        b[24] = ROTL64(a[21] ^ d[1],  2);
+
+        // Chi, the lanes in the complemented set need one NOT per row
+        n = ~b[ 2];
+        a[ 0] = b[0] ^ (b[1] | b[2]);
+        a[ 1] = b[1] ^ (n | b[3]);
+        a[ 2] = b[2] ^ (b[3] & b[4]);
+        a[ 3] = b[3] ^ (b[4] | b[0]);
+        a[ 4] = b[4] ^ (b[0] & b[1]);
+        n = ~b[ 9];
+        a[ 5] = b[5] ^ (b[6] | b[7]);
+        a[ 6] = b[6] ^ (b[7] & b[8]);
+        a[ 7] = b[7] ^ (b[8] | n);
+        a[ 8] = b[8] ^ (b[9] | b[5]);
+        a[ 9] = b[9] ^ (b[5] & b[6]);
+        n = ~b[13];
+        a[10] = b[10] ^ (b[11] | b[12]);
+        a[11] = b[11] ^ (b[12] & b[13]);
+        a[12] = b[12] ^ (n & b[14]);
+        a[13] = n ^ (b[14] | b[10]);
+        a[14] = b[14] ^ (b[10] & b[11]);
+        n = ~b[18];
+        a[15] = b[15] ^ (b[16] & b[17]);
+        a[16] = b[16] ^ (b[17] | b[18]);
+        a[17] = b[17] ^ (n | b[19]);
+        a[18] = n ^ (b[19] & b[15]);
+        a[19] = b[19] ^ (b[15] | b[16]);
+        n = ~b[21];
+        a[20] = b[20] ^ (n & b[22]);
+        a[21] = n ^ (b[22] | b[23]);
+        a[22] = b[22] ^ (b[23] & b[24]);
+        a[23] = b[23] ^ (b[24] | b[20]);
+        a[24] = b[24] ^ (b[20] & b[21]);
+
+        //  Iota
+        a[0] ^= keccakf_rndc[round];
+    }
+
+    for (i = 0; i < 25; i++)
+        st[i] = a[i] ^ keccakf_compl[i];
+}
+
 // compute a keccak hash (md) of given byte length from "in"
 typedef uint64_t state_t[25];
 
@@ -114,7 +215,90 @@ void keccak(const uint8_t *in, size_t inlen, uint8_t *md, int mdlen)
     reinterpret_cast<uint64_t*>(md)[i] = swab64(st[i]);
 }
 
+// absorb an input shorter than the rate straight into the state, the
+// blobs we get from pools (76 to 112 bytes) always fit in one block
+
+static void keccak1600_block(const uint8_t *in, size_t inlen, uint8_t *md)
+{
+    state_t st;
+    size_t words = inlen / 8;
+    size_t rest = inlen % 8;
+    size_t i;
+
+    for (i = 0; i < words; i++)
+        st[i] = get64(in, i);
+    for (; i < 25; i++)
+        st[i] = 0;
+
+    if (rest != 0) {
+        uint8_t temp[8] = { 0 };
+        memcpy(temp, in + words * 8, rest);
+        st[words] = get64(temp, 0);
+    }
+
+    st[words] ^= 1ull << (8 * rest);
+    st[136 / 8 - 1] ^= 0x80ull << 56;
+
+    keccakf(st, KECCAK_ROUNDS);
+
+    for (i = 0; i < 25; i++)
+        set64(md, i, st[i]);
+}
+
 void keccak1600(const uint8_t *in, size_t inlen, uint8_t *md)
 {
-    keccak(in, inlen, md, sizeof(state_t));
+    if (inlen < 136)
+        keccak1600_block(in, inlen, md);
+    else
+        keccak(in, inlen, md, sizeof(state_t));
+}
+
+void keccakf_x4(uint64_t st[4][25], int rounds)
+{
+#ifdef __x86_64
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    if (have_avx2) {
+        keccakf_x4_avx2(st, rounds);
+        return;
+    }
+#endif
+    for (int n = 0; n < 4; n++)
+        keccakf(st[n], rounds);
+}
+
+void keccak1600_x4(const uint8_t *const in[4], size_t inlen, uint8_t *const md[4])
+{
+  static const size_t rsiz = 136;
+  static const size_t rsizw = rsiz / 8;
+
+  uint64_t st[4][25];
+  size_t offset = 0;
+
+  memset(st, 0, sizeof(st));
+
+  for ( ; inlen - offset >= rsiz; offset += rsiz)
+  {
+    for (int n = 0; n < 4; n++)
+      for (size_t i = 0; i < rsizw; i++) st[n][i] ^= get64(in[n] + offset, i);
+    keccakf_x4(st, KECCAK_ROUNDS);
+  }
+
+  // last block and padding, the same for all four as the lengths match
+  size_t rest = inlen - offset;
+  for (int n = 0; n < 4; n++)
+  {
+    uint8_t temp[rsiz];
+    memcpy(temp, in[n] + offset, rest);
+    temp[rest] = 1;
+    memset(temp + rest + 1, 0, rsiz - rest - 1);
+    temp[rsiz - 1] |= 0x80;
+
+    for (size_t i = 0; i < rsizw; i++) st[n][i] ^= get64(temp, i);
+  }
+
+  keccakf_x4(st, KECCAK_ROUNDS);
+
+  for (int n = 0; n < 4; n++)
+    for (size_t i = 0 ; i < 25 ; ++i)
+      reinterpret_cast<uint64_t*>(md[n])[i] = swab64(st[n][i]);
 }
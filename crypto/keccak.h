@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <string.h>
+#include "kernel_level.h"
 
 static const size_t KECCAK_ROUNDS = 24;
 
@@ -20,6 +21,23 @@ void keccak(const uint8_t *in, size_t inlen, uint8_t *md, int mdlen);
 // update the state
 void keccakf(uint64_t st[25], int norounds);
 
+// the plain loop version of keccakf, kept as a reference for the tests
+void keccakf_ref(uint64_t st[25], int norounds);
+
 void keccak1600(const uint8_t *in, size_t inlen, uint8_t *md);
 
+// the round constants
+extern const uint64_t keccakf_rndc[24];
+
+// update four independent states, with AVX2 when the CPU has it
+void keccakf_x4(uint64_t st[4][25], int norounds);
+
+// keccak1600 of four inputs of the same length
+void keccak1600_x4(const uint8_t *const in[4], size_t inlen, uint8_t *const md[4]);
+
+#ifdef __x86_64
+// the AVX2 version of keccakf_x4, check the CPU before calling it
+void keccakf_x4_avx2(uint64_t st[4][25], int norounds);
+#endif
+
 #endif
@@ -0,0 +1,84 @@
+// keccak_avx2.cpp
+// Keccak-f[1600] on four independent states at once, one state per
+// 64 bit lane of an AVX2 register. Built with -mavx2 and only called
+// through keccakf_x4 after checking the CPU supports it.
+
+#include <immintrin.h>
+
+#include "keccak.h"
+
+#define ROTL64X4(x, y) _mm256_or_si256(_mm256_slli_epi64((x), (y)), _mm256_srli_epi64((x), 64 - (y)))
+
+void keccakf_x4_avx2(uint64_t st[4][25], int rounds)
+{
+    __m256i a[25], b[25], c[5], d;
+    int i, round;
+
+    for (i = 0; i < 25; i++)
+        a[i] = _mm256_set_epi64x(st[3][i], st[2][i], st[1][i], st[0][i]);
+
+    for (round = 0; round < rounds; round++) {
+
+        // Theta
+        for (i = 0; i < 5; i++)
+            c[i] = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a[i], a[i + 5]),
+                                                     _mm256_xor_si256(a[i + 10], a[i + 15])), a[i + 20]);
+
+        for (i = 0; i < 5; i++) {
+            d = _mm256_xor_si256(c[(i + 4) % 5], ROTL64X4(c[(i + 1) % 5], 1));
+            a[i] = _mm256_xor_si256(a[i], d);
+            a[i + 5] = _mm256_xor_si256(a[i + 5], d);
+            a[i + 10] = _mm256_xor_si256(a[i + 10], d);
+            a[i + 15] = _mm256_xor_si256(a[i + 15], d);
+            a[i + 20] = _mm256_xor_si256(a[i + 20], d);
+        }
+
+        // Rho Pi, unrolled so every rotation is an immediate
+        b[ 0] = a[ 0];
+        b[ 1] = ROTL64X4(a[ 6], 44);
+        b[ 2] = ROTL64X4(a[12], 43);
+        b[ 3] = ROTL64X4(a[18], 21);
+        b[ 4] = ROTL64X4(a[24], 14);
+        b[ 5] = ROTL64X4(a[ 3], 28);
+        b[ 6] = ROTL64X4(a[ 9], 20);
+        b[ 7] = ROTL64X4(a[10],  3);
+        b[ 8] = ROTL64X4(a[16], 45);
+        b[ 9] = ROTL64X4(a[22], 61);
+        b[10] = ROTL64X4(a[ 1],  1);
+        b[11] = ROTL64X4(a[ 7],  6);
+        b[12] = ROTL64X4(a[13], 25);
+        b[13] = ROTL64X4(a[19],  8);
+        b[14] = ROTL64X4(a[20], 18);
+        b[15] = ROTL64X4(a[ 4], 27);
+        b[16] = ROTL64X4(a[ 5], 36);
+        b[17] = ROTL64X4(a[11], 10);
+        b[18] = ROTL64X4(a[17], 15);
+        b[19] = ROTL64X4(a[23], 56);
+        b[20] = ROTL64X4(a[ 2], 62);
+        b[21] = ROTL64X4(a[ 8], 55);
+        b[22] = ROTL64X4(a[14], 39);
+        b[23] = ROTL64X4(a[15], 41);
+        b[24] = ROTL64X4(a[21],  2);
+
+        //  Chi
+        for (i = 0; i < 25; i += 5) {
+            a[i + 0] = _mm256_xor_si256(b[i + 0], _mm256_andnot_si256(b[i + 1], b[i + 2]));
+            a[i + 1] = _mm256_xor_si256(b[i + 1], _mm256_andnot_si256(b[i + 2], b[i + 3]));
+            a[i + 2] = _mm256_xor_si256(b[i + 2], _mm256_andnot_si256(b[i + 3], b[i + 4]));
+            a[i + 3] = _mm256_xor_si256(b[i + 3], _mm256_andnot_si256(b[i + 4], b[i + 0]));
+            a[i + 4] = _mm256_xor_si256(b[i + 4], _mm256_andnot_si256(b[i + 0], b[i + 1]));
+        }
+
+        //  Iota
+        a[0] = _mm256_xor_si256(a[0], _mm256_set1_epi64x(keccakf_rndc[round]));
+    }
+
+    for (i = 0; i < 25; i++) {
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), a[i]);
+        st[0][i] = lanes[0];
+        st[1][i] = lanes[1];
+        st[2][i] = lanes[2];
+        st[3][i] = lanes[3];
+    }
+}
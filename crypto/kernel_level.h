@@ -0,0 +1,95 @@
+/*!
+ * @file kernel_level.h
+ * Keeps the hash kernels of one x86-64 level apart from the others.
+ *
+ * The crypto sources are compiled once more for every x86-64 level with
+ * -march=x86-64-vN -DXMR_KERNEL_LEVEL=N. Such a build moves the classes
+ * into the inline namespace cryptonight::vN and gives every symbol the C
+ * sources export the suffix _vN, so all of them link into one binary and
+ * the miner picks one through the KernelSet of its level.
+ * Without XMR_KERNEL_LEVEL nothing is renamed.
+ */
+#ifndef KERNEL_LEVEL_H
+#define KERNEL_LEVEL_H
+
+#define XMR_KERNEL_CAT2(a, b) a##b
+#define XMR_KERNEL_CAT(a, b) XMR_KERNEL_CAT2(a, b)
+
+#ifdef XMR_KERNEL_LEVEL
+
+#define XMR_KERNEL_NAME(name) XMR_KERNEL_CAT(name##_v, XMR_KERNEL_LEVEL)
+#define XMR_KERNEL_NAMESPACE_BEGIN inline namespace XMR_KERNEL_CAT(v, XMR_KERNEL_LEVEL) {
+#define XMR_KERNEL_NAMESPACE_END }
+
+// keccak.h
+#define keccak XMR_KERNEL_NAME(keccak)
+#define keccakf XMR_KERNEL_NAME(keccakf)
+#define keccakf_ref XMR_KERNEL_NAME(keccakf_ref)
+#define keccak1600 XMR_KERNEL_NAME(keccak1600)
+#define keccakf_rndc XMR_KERNEL_NAME(keccakf_rndc)
+#define keccakf_x4 XMR_KERNEL_NAME(keccakf_x4)
+#define keccak1600_x4 XMR_KERNEL_NAME(keccak1600_x4)
+#define keccakf_x4_avx2 XMR_KERNEL_NAME(keccakf_x4_avx2)
+
+// groestl.h
+#define groestl XMR_KERNEL_NAME(groestl)
+#define groestl_aesni XMR_KERNEL_NAME(groestl_aesni)
+
+// blake256.h, and the tables blake256_x4.c shares with blake256.c
+#define blake256_init XMR_KERNEL_NAME(blake256_init)
+#define blake224_init XMR_KERNEL_NAME(blake224_init)
+#define blake256_update XMR_KERNEL_NAME(blake256_update)
+#define blake224_update XMR_KERNEL_NAME(blake224_update)
+#define blake256_final XMR_KERNEL_NAME(blake256_final)
+#define blake256_final_h XMR_KERNEL_NAME(blake256_final_h)
+#define blake224_final XMR_KERNEL_NAME(blake224_final)
+#define blake256_compress XMR_KERNEL_NAME(blake256_compress)
+#define blake256_hash XMR_KERNEL_NAME(blake256_hash)
+#define blake224_hash XMR_KERNEL_NAME(blake224_hash)
+#define blake256_hash_x4 XMR_KERNEL_NAME(blake256_hash_x4)
+#define hmac_blake256_init XMR_KERNEL_NAME(hmac_blake256_init)
+#define hmac_blake224_init XMR_KERNEL_NAME(hmac_blake224_init)
+#define hmac_blake256_update XMR_KERNEL_NAME(hmac_blake256_update)
+#define hmac_blake224_update XMR_KERNEL_NAME(hmac_blake224_update)
+#define hmac_blake256_final XMR_KERNEL_NAME(hmac_blake256_final)
+#define hmac_blake224_final XMR_KERNEL_NAME(hmac_blake224_final)
+#define hmac_blake256_hash XMR_KERNEL_NAME(hmac_blake256_hash)
+#define hmac_blake224_hash XMR_KERNEL_NAME(hmac_blake224_hash)
+#define sigma XMR_KERNEL_NAME(sigma)
+#define cst XMR_KERNEL_NAME(cst)
+
+// jh.h, and the tables jh_sse2.c shares with jh.c
+#define jh_hash XMR_KERNEL_NAME(jh_hash)
+#define jh_hash_sse2 XMR_KERNEL_NAME(jh_hash_sse2)
+#define JH224_H0 XMR_KERNEL_NAME(JH224_H0)
+#define JH256_H0 XMR_KERNEL_NAME(JH256_H0)
+#define JH384_H0 XMR_KERNEL_NAME(JH384_H0)
+#define JH512_H0 XMR_KERNEL_NAME(JH512_H0)
+#define E8_bitslice_roundconstant XMR_KERNEL_NAME(E8_bitslice_roundconstant)
+
+// skein.h, and the IVs skein_avx2.c shares with skein.c
+#define skein_hash XMR_KERNEL_NAME(skein_hash)
+#define skein512_256_x4_avx2 XMR_KERNEL_NAME(skein512_256_x4_avx2)
+#define SKEIN_256_IV_128 XMR_KERNEL_NAME(SKEIN_256_IV_128)
+#define SKEIN_256_IV_160 XMR_KERNEL_NAME(SKEIN_256_IV_160)
+#define SKEIN_256_IV_224 XMR_KERNEL_NAME(SKEIN_256_IV_224)
+#define SKEIN_256_IV_256 XMR_KERNEL_NAME(SKEIN_256_IV_256)
+#define SKEIN_512_IV_128 XMR_KERNEL_NAME(SKEIN_512_IV_128)
+#define SKEIN_512_IV_160 XMR_KERNEL_NAME(SKEIN_512_IV_160)
+#define SKEIN_512_IV_224 XMR_KERNEL_NAME(SKEIN_512_IV_224)
+#define SKEIN_512_IV_256 XMR_KERNEL_NAME(SKEIN_512_IV_256)
+#define SKEIN_512_IV_384 XMR_KERNEL_NAME(SKEIN_512_IV_384)
+#define SKEIN_512_IV_512 XMR_KERNEL_NAME(SKEIN_512_IV_512)
+#define SKEIN1024_IV_384 XMR_KERNEL_NAME(SKEIN1024_IV_384)
+#define SKEIN1024_IV_512 XMR_KERNEL_NAME(SKEIN1024_IV_512)
+#define SKEIN1024_IV_1024 XMR_KERNEL_NAME(SKEIN1024_IV_1024)
+
+#else
+
+#define XMR_KERNEL_NAME(name) name
+#define XMR_KERNEL_NAMESPACE_BEGIN
+#define XMR_KERNEL_NAMESPACE_END
+
+#endif
+
+#endif  // KERNEL_LEVEL_H
@@ -0,0 +1,245 @@
+// kernel_set.cpp
+// The KernelSet of one build. Compiled into the baseline and once more
+// into every x86-64 level, each time with the contexts and kernels of
+// that build, see kernel_level.h. The baseline one also keeps the list
+// of all sets.
+
+#include "kernel_set.hpp"
+
+#include "cryptonight.hpp"
+#ifdef __x86_64
+#include "cryptonight_aesni.hpp"
+#include "cryptonight_ssse3.hpp"
+#elif __PPC64__
+#include "cryptonight_altivec.hpp"
+#elif __sparcv9
+#include "cryptonight_sparc.hpp"
+#endif
+
+#define XMR_KERNEL_STR2(x) #x
+#define XMR_KERNEL_STR(x) XMR_KERNEL_STR2(x)
+
+using namespace cryptonight;
+
+namespace
+{
+
+//! An empty scratchpad gives the context slow memory of its own
+template <typename T> std::unique_ptr<Cryptonight> newContext(const Scratchpad &pad)
+{
+  using type = std::unique_ptr<Cryptonight>;
+  if (pad.get() == nullptr)
+    return type(new T);
+  return type(new T(pad));
+}
+
+std::unique_ptr<Cryptonight> backendContext(KernelSet::Backend backend, const Scratchpad &pad)
+{
+  switch (backend)
+  {
+  case KernelSet::HW_AES:
+#ifdef __x86_64
+    return newContext<CryptonightAESNI>(pad);
+#elif __PPC64__
+    return newContext<CryptonightAltivec>(pad);
+#elif __sparcv9
+    return newContext<CryptonightSparc>(pad);
+#endif
+    break;
+  case KernelSet::VAES:
+#ifdef __x86_64
+    return newContext<CryptonightVAES>(pad);
+#endif
+    break;
+  case KernelSet::SSSE3:
+#ifdef __x86_64
+    return newContext<CryptonightSSSE3>(pad);
+#endif
+    break;
+  case KernelSet::GENERIC:
+    break;
+  }
+  return newContext<Cryptonight>(pad);
+}
+
+//! The finalizers follow the backend, so aes_override keeps Groestl off hardware AES as well
+std::unique_ptr<Context> makeContext(KernelSet::Backend backend, const Scratchpad &pad)
+{
+  auto ctx = backendContext(backend, pad);
+  ctx->setAesFinalizer(backend == KernelSet::HW_AES || backend == KernelSet::VAES);
+  return std::unique_ptr<Context>(ctx.release());
+}
+
+template <size_t N, typename T> void hashWith(Context *const *ctx, const uint8_t *in, size_t len)
+{
+  T *tctx[N];
+  for (size_t i = 0; i < N; i++)
+    tctx[i] = static_cast<T *>(ctx[i]);
+  Cryptonight::calculateResults<N>(tctx, in, len);
+}
+
+#if defined(__PPC64__) || defined(__sparcv9)
+//! These backends only override the stages, so go through the virtual ones
+template <size_t N> void hashStaged(Context *const *ctx, const uint8_t *in, size_t len)
+{
+  for (size_t i = 0; i < N; i++)
+    static_cast<Cryptonight *>(ctx[i])->calculateResult(in + i * len, len);
+}
+#endif
+
+#ifdef __x86_64
+template <size_t N, bool PREFETCH> void hashAESNI(Context *const *ctx, const uint8_t *in, size_t len)
+{
+  CryptonightAESNI *actx[N];
+  for (size_t i = 0; i < N; i++)
+    actx[i] = static_cast<CryptonightAESNI *>(ctx[i]);
+  CryptonightAESNI::calculateResults<N, PREFETCH>(actx, in, len);
+}
+#endif
+
+//! The prefetch switch is baked in at compile time
+template <size_t N> KernelSet::HashFun hashSelector(KernelSet::Backend backend, bool noPrefetch)
+{
+  switch (backend)
+  {
+  case KernelSet::HW_AES:
+  case KernelSet::VAES:
+#ifdef __x86_64
+    return noPrefetch ? hashAESNI<N, false> : hashAESNI<N, true>;
+#elif defined(__PPC64__) || defined(__sparcv9)
+    return hashStaged<N>;
+#endif
+    break;
+  case KernelSet::SSSE3:
+#ifdef __x86_64
+    return hashWith<N, CryptonightSSSE3>;
+#endif
+    break;
+  case KernelSet::GENERIC:
+    break;
+  }
+  return hashWith<N, Cryptonight>;
+}
+
+KernelSet::HashFun waysSelector(KernelSet::Backend backend, bool noPrefetch, size_t ways)
+{
+  switch (ways)
+  {
+  case 5:
+    return hashSelector<5>(backend, noPrefetch);
+  case 4:
+    return hashSelector<4>(backend, noPrefetch);
+  case 3:
+    return hashSelector<3>(backend, noPrefetch);
+  case 2:
+    return hashSelector<2>(backend, noPrefetch);
+  default:
+    return hashSelector<1>(backend, noPrefetch);
+  }
+}
+
+template <typename T> array::type<uint8_t, 64> &nextWith(Context *ctx, uint32_t nonce)
+{
+  return static_cast<T *>(ctx)->hashNext(nonce);
+}
+
+#if defined(__PPC64__) || defined(__sparcv9)
+array::type<uint8_t, 64> &nextStaged(Context *ctx, uint32_t nonce)
+{
+  Cryptonight *cctx = static_cast<Cryptonight *>(ctx);
+  return cctx->calculateResult(cctx->blobWithNonce(nonce), cctx->blobLength());
+}
+#endif
+
+#ifdef __x86_64
+template <bool PREFETCH> array::type<uint8_t, 64> &nextAESNI(Context *ctx, uint32_t nonce)
+{
+  return static_cast<CryptonightAESNI *>(ctx)->hashNext<PREFETCH>(nonce);
+}
+#endif
+
+KernelSet::NextFun nextSelector(KernelSet::Backend backend, bool noPrefetch)
+{
+  switch (backend)
+  {
+  case KernelSet::HW_AES:
+  case KernelSet::VAES:
+#ifdef __x86_64
+    return noPrefetch ? nextAESNI<false> : nextAESNI<true>;
+#elif defined(__PPC64__) || defined(__sparcv9)
+    return nextStaged;
+#endif
+    break;
+  case KernelSet::SSSE3:
+#ifdef __x86_64
+    return nextWith<CryptonightSSSE3>;
+#endif
+    break;
+  case KernelSet::GENERIC:
+    break;
+  }
+  return nextWith<Cryptonight>;
+}
+}
+
+namespace cryptonight
+{
+//! The set of this build, kernelSet_vN in a level build
+extern const KernelSet XMR_KERNEL_NAME(kernelSet);
+}
+
+#ifdef XMR_KERNEL_LEVEL
+const KernelSet cryptonight::XMR_KERNEL_NAME(kernelSet) = {"x86-64-v" XMR_KERNEL_STR(XMR_KERNEL_LEVEL),
+                                                           XMR_KERNEL_LEVEL, makeContext, waysSelector,
+                                                           nextSelector};
+#else
+#ifdef __x86_64
+const KernelSet cryptonight::kernelSet = {"x86-64", 1, makeContext, waysSelector, nextSelector};
+#else
+const KernelSet cryptonight::kernelSet = {"baseline", 0, makeContext, waysSelector, nextSelector};
+#endif
+
+// The levels CMake built, see XMR_HAVE_KERNEL_LEVEL_N
+namespace cryptonight
+{
+#ifdef XMR_HAVE_KERNEL_LEVEL_2
+extern const KernelSet kernelSet_v2;
+#endif
+#ifdef XMR_HAVE_KERNEL_LEVEL_3
+extern const KernelSet kernelSet_v3;
+#endif
+#ifdef XMR_HAVE_KERNEL_LEVEL_4
+extern const KernelSet kernelSet_v4;
+#endif
+}
+
+Context::~Context()
+{
+}
+
+const std::vector<const KernelSet *> &KernelSet::all()
+{
+  static const std::vector<const KernelSet *> sets = {
+    &kernelSet,
+#ifdef XMR_HAVE_KERNEL_LEVEL_2
+    &kernelSet_v2,
+#endif
+#ifdef XMR_HAVE_KERNEL_LEVEL_3
+    &kernelSet_v3,
+#endif
+#ifdef XMR_HAVE_KERNEL_LEVEL_4
+    &kernelSet_v4,
+#endif
+  };
+  return sets;
+}
+
+const KernelSet &KernelSet::best(int level)
+{
+  const KernelSet *best = all().front();
+  for (const KernelSet *set : all())
+    if (set->level <= level)
+      best = set;
+  return *best;
+}
+#endif
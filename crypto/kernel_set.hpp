@@ -0,0 +1,86 @@
+/*!
+ * @file kernel_set.hpp
+ * The table of the hash kernels of one build. The baseline build of the
+ * crypto sources provides one, and on x86-64 every level the compiler
+ * knows provides another, see kernel_level.h.
+ */
+#ifndef KERNEL_SET_HPP
+#define KERNEL_SET_HPP
+
+#include "context.hpp"
+#include "scratchpad.hpp"
+#include <memory>
+#include <vector>
+
+namespace cryptonight
+{
+
+/*!
+ * The hash kernels of one build, the contexts they run on and the
+ * x86-64 level the CPU needs for them
+ */
+struct KernelSet
+{
+  /*!
+   * How the kernels compute AES
+   */
+  enum Backend
+  {
+    GENERIC = 0,
+    SSSE3   = 1,
+    HW_AES  = 2,
+    VAES    = 3
+  };
+
+  //! Hashes N inputs of len bytes laid out back to back, one context each
+  typedef void (*HashFun)(Context *const *ctx, const uint8_t *in, size_t len);
+  //! Hashes the blob set on ctx with the given nonce
+  typedef array::type<uint8_t, 64> &(*NextFun)(Context *ctx, uint32_t nonce);
+
+  //! The name of the build, e.g. x86-64-v3
+  const char *name;
+  //! The x86-64 level the kernels were built for, 1 for the baseline, 0 off x86-64
+  int level;
+
+  /*!
+   * Create a context of the backend. The finalizers use hardware AES
+   * if the backend does.
+   * \param backend The backend
+   * \param pad     The scratchpad, an empty one gives the context slow memory of its own
+   * \return The context, only to be handed to the functions of this set
+   */
+  std::unique_ptr<Context> (*make)(Backend backend, const Scratchpad &pad);
+
+  /*!
+   * Pick the function hashing ways inputs at once
+   * \param backend    The backend the contexts were made with
+   * \param noPrefetch True if the main loop must not prefetch
+   * \param ways       The number of inputs, 1 to Cryptonight::MAX_WAYS
+   * \return The function
+   */
+  HashFun (*hash)(Backend backend, bool noPrefetch, size_t ways);
+
+  /*!
+   * Pick the function hashing consecutive nonces of the stored blob
+   * \param backend    The backend the context was made with
+   * \param noPrefetch True if the main loop must not prefetch
+   * \return The function
+   */
+  NextFun (*next)(Backend backend, bool noPrefetch);
+
+  /*!
+   * Return the sets this binary was built with, by ascending level
+   * \return The sets, the baseline one first
+   */
+  static const std::vector<const KernelSet *> &all();
+
+  /*!
+   * Return the set of the highest level a CPU runs
+   * \param level The x86-64 level of the CPU, 0 off x86-64
+   * \return The set
+   */
+  static const KernelSet &best(int level);
+};
+}
+
+#endif  // KERNEL_SET_HPP
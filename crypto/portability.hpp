@@ -50,7 +50,7 @@ constexpr uint64_t swab64(uint64_t in)
 #endif
 }
 
-constexpr uint64_t get64(const uint8_t *ptr, size_t offset)
+inline uint64_t get64(const uint8_t *ptr, size_t offset)
 {
   return swab64(reinterpret_cast<const uint64_t*>(ptr)[offset]);
 }
@@ -60,7 +60,7 @@ inline void set64(uint8_t *ptr, size_t offset, uint64_t value)
   reinterpret_cast<uint64_t*>(ptr)[offset] = swab64(value);
 }
 
-constexpr uint32_t get32(const uint8_t *ptr, size_t offset)
+inline uint32_t get32(const uint8_t *ptr, size_t offset)
 {
   return swab32(reinterpret_cast<const uint32_t*>(ptr)[offset]);
 }
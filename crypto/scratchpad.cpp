@@ -0,0 +1,239 @@
+#include "scratchpad.hpp"
+
+#include "cryptonight.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace cryptonight;
+
+ScratchpadArena::ScratchpadArena(size_t count, size_t size, Policy policy, bool gigantic, size_t colour)
+    : m_memory(nullptr), m_length(0), m_count(count), m_size(size), m_colour(colour), m_pageSize(0),
+      m_fellBack(false), m_locked(false), m_mapped(false)
+{
+  if (policy == SLOW_MEMORY)
+  {
+    mapSlow();
+    return;
+  }
+
+  // A gigantic page is only worth it when the system has one reserved
+  bool huge = gigantic && count * (size + colour) <= GIGANTIC_PAGE && freePages(GIGANTIC_PAGE) > 0 &&
+              mapHuge(GIGANTIC_PAGE);
+  if (!huge) huge = mapHuge(HUGE_PAGE);
+
+  if (!huge)
+  {
+    if (policy != HUGE_OR_SLOW) throw Exception("Failed to map the scratchpads on huge pages");
+    m_fellBack = true;
+    mapSlow();
+    return;
+  }
+
+#ifdef __linux
+  if (policy != HUGE_NO_MLOCK) m_locked = mlock(m_memory, m_length) == 0;
+  if (!m_locked && policy == HUGE_ONLY)
+  {
+    munmap(m_memory, m_length);
+    throw Exception("Failed to lock the huge pages of the scratchpads");
+  }
+#endif
+}
+
+ScratchpadArena::~ScratchpadArena()
+{
+#ifdef __linux
+  if (m_mapped)
+  {
+    munmap(m_memory, m_length);
+    return;
+  }
+#endif
+  ::free(m_memory);
+}
+
+bool ScratchpadArena::mapHuge(size_t pageSize)
+{
+#if defined(__linux) && defined(MAP_HUGETLB)
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE;
+#ifdef MAP_HUGE_SHIFT
+  flags |= __builtin_ctzll(pageSize) << MAP_HUGE_SHIFT;
+#endif
+  size_t length = (m_count * (m_size + m_colour) + pageSize - 1) & ~(pageSize - 1);
+  void *memory  = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (memory == MAP_FAILED) return false;
+
+  madvise(memory, length, MADV_RANDOM);
+  m_memory   = reinterpret_cast<uint8_t *>(memory);
+  m_length   = length;
+  m_pageSize = pageSize;
+  m_mapped   = true;
+  return true;
+#else
+  (void)pageSize;
+  return false;
+#endif
+}
+
+void ScratchpadArena::mapSlow()
+{
+  void *memory;
+  m_length = m_count * (m_size + m_colour);
+#ifndef __sparc
+  // Aligned to a huge page so transparent huge pages can back all of it
+  if (::posix_memalign(&memory, HUGE_PAGE, m_length) != 0) throw std::bad_alloc();
+#else
+  if ((memory = malloc(m_length)) == nullptr) throw std::bad_alloc();
+#endif
+  m_memory = reinterpret_cast<uint8_t *>(memory);
+#ifdef __linux
+  // One piece of advice per call, they are values and not flags
+  madvise(memory, m_length, MADV_RANDOM);
+  madvise(memory, m_length, MADV_WILLNEED);
+  madvise(memory, m_length, MADV_HUGEPAGE);
+  if (!geteuid()) m_locked = mlock(memory, m_length) == 0;
+#endif
+}
+
+#ifdef __linux
+namespace
+{
+//! The bits of a /proc/self/pagemap entry
+const uint64_t PAGEMAP_PRESENT = uint64_t(1) << 63;
+const uint64_t PAGEMAP_FRAME   = (uint64_t(1) << 55) - 1;
+//! The bits of a /proc/kpageflags entry, see linux/kernel-page-flags.h
+const uint64_t KPF_COMPOUND_HEAD = uint64_t(1) << 15;
+const uint64_t KPF_COMPOUND_TAIL = uint64_t(1) << 16;
+const uint64_t KPF_THP           = uint64_t(1) << 22;
+
+/*!
+ * Read one 64 bit entry of a /proc file indexed by page
+ * \param fd    The file
+ * \param index The number of the entry
+ * \param entry The entry
+ * \return False if it cannot be read
+ */
+bool readEntry(int fd, uint64_t index, uint64_t &entry)
+{
+  return pread(fd, &entry, sizeof(entry), off_t(index * sizeof(entry))) == sizeof(entry);
+}
+
+/*!
+ * Look up the page frame behind a virtual address
+ * \param pagemap /proc/self/pagemap
+ * \param addr    The address
+ * \param frame   The frame, 0 if the page is not present
+ * \return False if it cannot be read
+ */
+bool frameOf(int pagemap, uintptr_t addr, uint64_t &frame)
+{
+  uint64_t entry;
+  if (!readEntry(pagemap, addr / size_t(getpagesize()), entry)) return false;
+  frame = (entry & PAGEMAP_PRESENT) != 0 ? entry & PAGEMAP_FRAME : 0;
+  return true;
+}
+}
+#endif
+
+size_t ScratchpadArena::hugeBytes(size_t i) const
+{
+  // Explicit huge pages back the whole mapping
+  if (m_pageSize != 0) return m_size;
+
+#ifdef __linux
+  // Transparent huge pages are only seen per page. Every 2 MB block of
+  // the scratchpad counts when its first and last page are the head and
+  // the tail of one transparent huge page, frames one after the other.
+  const int pagemap    = open("/proc/self/pagemap", O_RDONLY);
+  const int kpageflags = open("/proc/kpageflags", O_RDONLY);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(pad(i));
+  const uintptr_t end   = begin + m_size;
+  const size_t small    = size_t(getpagesize());
+  size_t huge           = 0;
+
+  for (uintptr_t block = begin & ~(HUGE_PAGE - 1); pagemap >= 0 && kpageflags >= 0 && block < end;
+       block += HUGE_PAGE)
+  {
+    uint64_t head, tail, headFlags, tailFlags;
+    if (!frameOf(pagemap, block, head) || !frameOf(pagemap, block + HUGE_PAGE - small, tail)) break;
+    // Without CAP_SYS_ADMIN the frames read as 0
+    if (head == 0 || tail != head + HUGE_PAGE / small - 1) continue;
+    if (!readEntry(kpageflags, head, headFlags) || !readEntry(kpageflags, tail, tailFlags)) break;
+    if ((headFlags & (KPF_THP | KPF_COMPOUND_HEAD)) != (KPF_THP | KPF_COMPOUND_HEAD) ||
+        (tailFlags & (KPF_THP | KPF_COMPOUND_TAIL)) != (KPF_THP | KPF_COMPOUND_TAIL))
+      continue;
+    huge += std::min(end, block + HUGE_PAGE) - std::max(begin, block);
+  }
+
+  if (pagemap >= 0) close(pagemap);
+  if (kpageflags >= 0) close(kpageflags);
+  return huge;
+#else
+  (void)i;
+  return 0;
+#endif
+}
+
+bool ScratchpadArena::allHuge() const
+{
+  for (size_t i = 0; i < m_count; ++i)
+    if (hugeBytes(i) < m_size) return false;
+  return true;
+}
+
+void ScratchpadArena::touch()
+{
+  memset(m_memory, 0, m_count * (m_size + m_colour));
+}
+
+size_t ScratchpadArena::pagesOffNode(size_t i, int node) const
+{
+#if defined(__linux) && defined(SYS_move_pages)
+  // Slow memory may be on small pages, so look at every one of those. A
+  // scratchpad behind a colour offset starts and ends half way into a page.
+  const size_t step  = m_pageSize != 0 ? m_pageSize : size_t(4096);
+  const uintptr_t lo = reinterpret_cast<uintptr_t>(pad(i)) & ~(step - 1);
+  const uintptr_t hi = reinterpret_cast<uintptr_t>(pad(i)) + m_size;
+  const size_t n     = (hi - lo + step - 1) / step;
+  std::vector<void *> pages(n);
+  std::vector<int> status(n);
+  for (size_t p = 0; p < n; ++p)
+    pages[p] = reinterpret_cast<void *>(lo + p * step);
+
+  // Without target nodes move_pages moves nothing, it only fills in the status
+  if (syscall(SYS_move_pages, 0, n, pages.data(), nullptr, status.data(), 0) != 0) return 0;
+
+  // A page not faulted in yet has a negative status, it ends up on the
+  // node of the thread that touches it first
+  size_t off = 0;
+  for (size_t p = 0; p < n; ++p)
+    off += status[p] >= 0 && status[p] != node;
+  return off;
+#else
+  (void)i;
+  (void)node;
+  return 0;
+#endif
+}
+
+size_t ScratchpadArena::freePages(size_t pageSize)
+{
+  std::ifstream in("/sys/kernel/mm/hugepages/hugepages-" + std::to_string(pageSize / 1024) + "kB/free_hugepages");
+  size_t pages = 0;
+  return in >> pages ? pages : 0;
+}
+
+Scratchpad Scratchpad::allocate(size_t size)
+{
+  return Scratchpad(std::make_shared<ScratchpadArena>(1, size, ScratchpadArena::SLOW_MEMORY), 0);
+}
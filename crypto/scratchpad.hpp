@@ -0,0 +1,222 @@
+/*!
+ * @file scratchpad.hpp
+ * The memory of the scratchpads. An arena is one mapping carved into
+ * scratchpads, backed by explicit huge pages where the policy and the
+ * system allow it. Every hash touches its whole scratchpad at random, so
+ * a scratchpad on 4 kB pages misses the TLB on nearly every iteration.
+ */
+#ifndef SCRATCHPAD_HPP
+#define SCRATCHPAD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace cryptonight
+{
+
+/*!
+ * One mapping holding a number of scratchpads of the same size. The
+ * first one is aligned to the page size of the mapping, every following
+ * one starts a cache colour offset further into its page, so the
+ * scratchpads of one thread do not all map to the same cache sets.
+ */
+class ScratchpadArena
+{
+public:
+  /*!
+   * Where the memory comes from, the use_slow_memory options of config.txt
+   */
+  enum Policy
+  {
+    //! Normal pages with transparent huge pages advised, the "always" option
+    SLOW_MEMORY,
+    //! Explicit huge pages, normal pages if there are none, the "warn" option
+    HUGE_OR_SLOW,
+    //! Explicit huge pages that are not locked, the "no_mlck" option
+    HUGE_NO_MLOCK,
+    //! Explicit locked huge pages or nothing, the "never" option
+    HUGE_ONLY
+  };
+
+  //! The size of a huge page
+  static const size_t HUGE_PAGE = size_t(1) << 21;
+  //! The size of a gigantic page
+  static const size_t GIGANTIC_PAGE = size_t(1) << 30;
+
+  /*!
+   * Map the memory of count scratchpads. With gigantic set a 1 GB page
+   * is tried first for all of them together, when the system has one
+   * free. Throws cryptonight::Exception when the policy does not allow
+   * the memory the system can give.
+   * \param count    The number of scratchpads
+   * \param size     The size of each scratchpad
+   * \param policy   Where the memory may come from
+   * \param gigantic Whether to try 1 GB pages
+   * \param colour   The gap between two scratchpads, a multiple of 64 bytes
+   */
+  ScratchpadArena(size_t count, size_t size, Policy policy, bool gigantic = false, size_t colour = 0);
+  ~ScratchpadArena();
+
+  ScratchpadArena(const ScratchpadArena &) = delete;
+  ScratchpadArena &operator=(const ScratchpadArena &) = delete;
+
+  /*!
+   * Return a scratchpad
+   * \param i The number of the scratchpad
+   * \return Its memory
+   */
+  inline uint8_t *pad(size_t i) const
+  {
+    return m_memory + i * (m_size + m_colour);
+  }
+
+  //! The number of scratchpads
+  inline size_t count() const
+  {
+    return m_count;
+  }
+
+  //! The size of a scratchpad
+  inline size_t size() const
+  {
+    return m_size;
+  }
+
+  //! The gap between two scratchpads
+  inline size_t colour() const
+  {
+    return m_colour;
+  }
+
+  //! The page size asked of the kernel, 0 for slow memory
+  inline size_t pageSize() const
+  {
+    return m_pageSize;
+  }
+
+  //! Whether explicit huge pages were asked for but slow memory was taken
+  inline bool fellBack() const
+  {
+    return m_fellBack;
+  }
+
+  //! Whether the memory is locked
+  inline bool locked() const
+  {
+    return m_locked;
+  }
+
+  /*!
+   * Find how many bytes of a scratchpad really are on huge pages. All of
+   * them with explicit huge pages. Transparent huge pages are looked up
+   * page by page in /proc/self/pagemap and /proc/kpageflags, which needs
+   * CAP_SYS_ADMIN; without it none of them count.
+   * \param i The number of the scratchpad
+   * \return The bytes on huge pages
+   */
+  size_t hugeBytes(size_t i) const;
+
+  /*!
+   * Return true if every scratchpad is completely on huge pages
+   * \return The result of hugeBytes for all of them
+   */
+  bool allHuge() const;
+
+  /*!
+   * Write zeros to every scratchpad. A page lands on the NUMA node of
+   * the thread that touches it first, so call this from a thread bound
+   * to the node the scratchpads are meant for.
+   */
+  void touch();
+
+  /*!
+   * Ask the kernel through move_pages which NUMA node every page of a
+   * scratchpad is on
+   * \param i    The number of the scratchpad
+   * \param node The node the pages should be on
+   * \return The pages present on another node, 0 where move_pages is
+   *         not available. Pages not faulted in yet do not count.
+   */
+  size_t pagesOffNode(size_t i, int node) const;
+
+  /*!
+   * Return the number of free pages of a size, from sysfs
+   * \param pageSize The page size
+   * \return The free pages, 0 where sysfs is not available
+   */
+  static size_t freePages(size_t pageSize);
+
+private:
+  //! Try an explicit huge page mapping
+  bool mapHuge(size_t pageSize);
+  //! Map slow memory
+  void mapSlow();
+
+  //! The start of the mapping
+  uint8_t *m_memory;
+  //! The length of the mapping
+  size_t m_length;
+  size_t m_count;
+  size_t m_size;
+  size_t m_colour;
+  size_t m_pageSize;
+  bool m_fellBack;
+  bool m_locked;
+  //! Whether m_memory came from mmap rather than posix_memalign
+  bool m_mapped;
+};
+
+/*!
+ * A scratchpad out of an arena. The arena is shared by every scratchpad
+ * carved from it and goes away with the last of them.
+ */
+class Scratchpad
+{
+public:
+  //! An empty scratchpad
+  Scratchpad() : m_pad(nullptr)
+  {
+  }
+
+  /*!
+   * Take a scratchpad of an arena
+   * \param arena The arena
+   * \param i     The number of the scratchpad
+   */
+  Scratchpad(const std::shared_ptr<ScratchpadArena> &arena, size_t i) : m_arena(arena), m_pad(arena->pad(i))
+  {
+  }
+
+  /*!
+   * Map one scratchpad of slow memory, the way a context without an
+   * arena of its own gets its memory
+   * \param size The size of the scratchpad
+   * \return The scratchpad
+   */
+  static Scratchpad allocate(size_t size);
+
+  //! The memory of the scratchpad
+  inline uint8_t *get() const
+  {
+    return m_pad;
+  }
+
+  //! A byte of the scratchpad
+  inline uint8_t &operator[](size_t i) const
+  {
+    return m_pad[i];
+  }
+
+  //! The arena the scratchpad comes from
+  inline const std::shared_ptr<ScratchpadArena> &arena() const
+  {
+    return m_arena;
+  }
+
+private:
+  std::shared_ptr<ScratchpadArena> m_arena;
+  uint8_t *m_pad;
+};
+}
+#endif  // SCRATCHPAD_HPP
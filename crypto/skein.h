@@ -28,6 +28,7 @@
 **
 ***************************************************************************/
 #include "skein_port.h"                      /* get platform-specific definitions */
+#include "kernel_level.h"                    /* the names of a level build */
 
 typedef enum
 {
@@ -44,4 +45,9 @@ typedef u08b_t   BitSequence;               /* bit stream type */
 SkeinHashReturn skein_hash(int hashbitlen,   const BitSequence *data,
                       SkeinDataLength databitlen,  BitSequence *hashval);
 
+#ifdef __x86_64
+/* Skein-512-256 of four messages of the same byte length with AVX2, check the CPU before calling it */
+void skein512_256_x4_avx2(const u08b_t *const msg[4], size_t msgByteCnt, u08b_t *const hashVal[4]);
+#endif
+
 #endif  /* ifndef _SKEIN_H_ */
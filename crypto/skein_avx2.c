@@ -0,0 +1,192 @@
+/***********************************************************************
+**
+** Skein-512-256 of four messages of the same length at once, one
+** message per 64 bit lane of an AVX2 register. Built with -mavx2 and
+** only called after checking the CPU supports it.
+**
+** The rounds are the ones of Skein_512_Process_Block in skein.c, and
+** the UBI chaining is what skein_hash ends up doing for a whole number
+** of bytes: the message blocks, the final (zero padded) message block
+** and one output block.
+**
+************************************************************************/
+
+#include "skein.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+#include <string.h>
+
+/* the initial chaining value of Skein-512-256, from skein.c */
+extern const u64b_t SKEIN_512_IV_256[];
+
+#define SKEIN_KS_PARITY         (((u64b_t) 0x1BD11BDA << 32) + 0xA9FC1A22)
+#define SKEIN_512_BLOCK_BYTES   (64)
+
+#define T1_FLAG_FIRST   (((u64b_t)  1) << 62)
+#define T1_FLAG_FINAL   (((u64b_t)  1) << 63)
+#define T1_TYPE_MSG     (((u64b_t) 48) << 56)
+#define T1_TYPE_OUT     (((u64b_t) 63) << 56)
+
+enum
+    {
+    R_512_0_0=46, R_512_0_1=36, R_512_0_2=19, R_512_0_3=37,
+    R_512_1_0=33, R_512_1_1=27, R_512_1_2=14, R_512_1_3=42,
+    R_512_2_0=17, R_512_2_1=49, R_512_2_2=36, R_512_2_3=39,
+    R_512_3_0=44, R_512_3_1= 9, R_512_3_2=54, R_512_3_3=56,
+    R_512_4_0=39, R_512_4_1=30, R_512_4_2=34, R_512_4_3=24,
+    R_512_5_0=13, R_512_5_1=50, R_512_5_2=10, R_512_5_3=17,
+    R_512_6_0=25, R_512_6_1=29, R_512_6_2=39, R_512_6_3=43,
+    R_512_7_0= 8, R_512_7_1=35, R_512_7_2=56, R_512_7_3=22
+    };
+
+#define ADD(a,b)    _mm256_add_epi64((a),(b))
+#define XOR(a,b)    _mm256_xor_si256((a),(b))
+#define RotL_64x4(x,N) _mm256_or_si256(_mm256_slli_epi64((x),(N)),_mm256_srli_epi64((x),64-(N)))
+
+#define Round512(p0,p1,p2,p3,p4,p5,p6,p7,ROT)                                       \
+    X##p0 = ADD(X##p0,X##p1); X##p1 = XOR(RotL_64x4(X##p1,ROT##_0),X##p0);         \
+    X##p2 = ADD(X##p2,X##p3); X##p3 = XOR(RotL_64x4(X##p3,ROT##_1),X##p2);         \
+    X##p4 = ADD(X##p4,X##p5); X##p5 = XOR(RotL_64x4(X##p5,ROT##_2),X##p4);         \
+    X##p6 = ADD(X##p6,X##p7); X##p7 = XOR(RotL_64x4(X##p7,ROT##_3),X##p6);
+
+#define I512(R)                                                                     \
+    X0 = ADD(X0,ks[((R)+1) % 9]);   /* inject the key schedule value */            \
+    X1 = ADD(X1,ks[((R)+2) % 9]);                                                   \
+    X2 = ADD(X2,ks[((R)+3) % 9]);                                                   \
+    X3 = ADD(X3,ks[((R)+4) % 9]);                                                   \
+    X4 = ADD(X4,ks[((R)+5) % 9]);                                                   \
+    X5 = ADD(X5,ADD(ks[((R)+6) % 9],_mm256_set1_epi64x(ts[((R)+1) % 3])));          \
+    X6 = ADD(X6,ADD(ks[((R)+7) % 9],_mm256_set1_epi64x(ts[((R)+2) % 3])));          \
+    X7 = ADD(X7,ADD(ks[((R)+8) % 9],_mm256_set1_epi64x((R)+1)));
+
+#define R512_8_rounds(R)                       \
+    Round512(0,1,2,3,4,5,6,7,R_512_0);         \
+    Round512(2,1,4,7,6,5,0,3,R_512_1);         \
+    Round512(4,1,6,3,0,5,2,7,R_512_2);         \
+    Round512(6,1,0,7,2,5,4,3,R_512_3);         \
+    I512(2*(R));                               \
+    Round512(0,1,2,3,4,5,6,7,R_512_4);         \
+    Round512(2,1,4,7,6,5,0,3,R_512_5);         \
+    Round512(4,1,6,3,0,5,2,7,R_512_6);         \
+    Round512(6,1,0,7,2,5,4,3,R_512_7);         \
+    I512(2*(R)+1);
+
+/* one UBI block: X <- Threefish(key X, tweak T0/T1, w) ^ w */
+static void Skein_512_Process_Block_x4(__m256i X[8], const __m256i w[8], u64b_t T0, u64b_t T1)
+    {
+    __m256i ks[9];
+    __m256i X0,X1,X2,X3,X4,X5,X6,X7;
+    u64b_t  ts[3];
+    int     i;
+
+    ks[8] = _mm256_set1_epi64x(SKEIN_KS_PARITY);
+    for (i = 0; i < 8; i++)
+        {
+        ks[i] = X[i];
+        ks[8] = XOR(ks[8],X[i]);
+        }
+
+    ts[0] = T0;
+    ts[1] = T1;
+    ts[2] = T0 ^ T1;
+
+    X0 = ADD(w[0],ks[0]);                       /* do the first full key injection */
+    X1 = ADD(w[1],ks[1]);
+    X2 = ADD(w[2],ks[2]);
+    X3 = ADD(w[3],ks[3]);
+    X4 = ADD(w[4],ks[4]);
+    X5 = ADD(w[5],ADD(ks[5],_mm256_set1_epi64x(ts[0])));
+    X6 = ADD(w[6],ADD(ks[6],_mm256_set1_epi64x(ts[1])));
+    X7 = ADD(w[7],ks[7]);
+
+    R512_8_rounds( 0);
+    R512_8_rounds( 1);
+    R512_8_rounds( 2);
+    R512_8_rounds( 3);
+    R512_8_rounds( 4);
+    R512_8_rounds( 5);
+    R512_8_rounds( 6);
+    R512_8_rounds( 7);
+    R512_8_rounds( 8);
+
+    /* do the final "feedforward" xor */
+    X[0] = XOR(X0,w[0]);
+    X[1] = XOR(X1,w[1]);
+    X[2] = XOR(X2,w[2]);
+    X[3] = XOR(X3,w[3]);
+    X[4] = XOR(X4,w[4]);
+    X[5] = XOR(X5,w[5]);
+    X[6] = XOR(X6,w[6]);
+    X[7] = XOR(X7,w[7]);
+    }
+
+/* the words of one block of each message, little endian */
+static void Skein_Get64_x4(__m256i w[8], const u08b_t *const blk[4])
+    {
+    u64b_t words[4][8];
+    int    i, n;
+
+    for (n = 0; n < 4; n++)
+        {
+        memcpy(words[n],blk[n],sizeof(words[n]));
+        for (i = 0; i < 8; i++)
+            words[n][i] = Skein_Swap64(words[n][i]);
+        }
+    for (i = 0; i < 8; i++)
+        w[i] = _mm256_set_epi64x(words[3][i],words[2][i],words[1][i],words[0][i]);
+    }
+
+/* msgByteCnt is the same for all four, the hashes are 32 bytes */
+void skein512_256_x4_avx2(const u08b_t *const msg[4], size_t msgByteCnt, u08b_t *const hashVal[4])
+    {
+    u08b_t  pad[4][SKEIN_512_BLOCK_BYTES];
+    const u08b_t *blk[4];
+    __m256i X[8], w[8];
+    u64b_t  T0 = 0, T1 = T1_FLAG_FIRST | T1_TYPE_MSG;
+    size_t  offset, rest;
+    int     i, n;
+
+    for (i = 0; i < 8; i++)
+        X[i] = _mm256_set1_epi64x(SKEIN_512_IV_256[i]);
+
+    /* every full block but the last goes straight through, the last one is the final block */
+    for (offset = 0; msgByteCnt - offset > SKEIN_512_BLOCK_BYTES; offset += SKEIN_512_BLOCK_BYTES)
+        {
+        for (n = 0; n < 4; n++)
+            blk[n] = msg[n] + offset;
+        Skein_Get64_x4(w,blk);
+        T0 += SKEIN_512_BLOCK_BYTES;
+        Skein_512_Process_Block_x4(X,w,T0,T1);
+        T1 &= ~T1_FLAG_FIRST;
+        }
+
+    rest = msgByteCnt - offset;
+    for (n = 0; n < 4; n++)
+        {
+        memset(pad[n],0,sizeof(pad[n]));
+        memcpy(pad[n],msg[n] + offset,rest);
+        blk[n] = pad[n];
+        }
+    Skein_Get64_x4(w,blk);
+    Skein_512_Process_Block_x4(X,w,T0 + rest,T1 | T1_FLAG_FINAL);
+
+    /* the output block is counter 0 */
+    for (i = 0; i < 8; i++)
+        w[i] = _mm256_setzero_si256();
+    Skein_512_Process_Block_x4(X,w,sizeof(u64b_t),T1_FLAG_FIRST | T1_FLAG_FINAL | T1_TYPE_OUT);
+
+    for (i = 0; i < 4; i++)
+        {
+        u64b_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes,X[i]);
+        for (n = 0; n < 4; n++)
+            {
+            lanes[n] = Skein_Swap64(lanes[n]);
+            memcpy(hashVal[n] + i * 8,&lanes[n],sizeof(u64b_t));
+            }
+        }
+    }
+
+#endif
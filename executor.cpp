@@ -266,6 +266,14 @@ void executor::on_miner_result(size_t pool_id, job_result& oResult)
 		return;
 	}
 
+	if(!audit_nonce(oResult))
+	{
+		printer::inst()->print_msg(L1, "Nonce %08x of job %s was found twice, not sending it again.",
+			(unsigned int)oResult.iNonce, oResult.sJobID);
+		log_result_error("[DUPLICATE NONCE]");
+		return;
+	}
+
 	using namespace std::chrono;
 	size_t t_start = time_point_cast<milliseconds>(high_resolution_clock::now()).time_since_epoch().count();
 	bool bResult = pool->cmd_submit(oResult.sJobID, oResult.iNonce, oResult.bResult);
@@ -302,6 +310,16 @@ void executor::on_miner_result(size_t pool_id, job_result& oResult)
 	}
 }
 
+bool executor::audit_nonce(const job_result& oResult)
+{
+	if(sAuditJobId != oResult.sJobID)
+	{
+		sAuditJobId = oResult.sJobID;
+		vAuditNonces.clear();
+	}
+	return vAuditNonces.insert(oResult.iNonce).second;
+}
+
 void executor::on_reconnect(size_t pool_id)
 {
 	jpsock* pool = pick_pool_by_id(pool_id);
@@ -367,6 +385,8 @@ void executor::ex_main()
 	minethd::miner_work oWork = minethd::miner_work();
 	pvThreads = minethd::thread_starter(oWork);
 	telem = new telemetry(pvThreads->size());
+	// Taken every tick, kept so the ticks do not allocate
+	std::vector<minethd::thd_stats> vThdStats;
 
 	current_pool_id = usr_pool_id;
 	usr_pool = new jpsock(usr_pool_id, jconf::inst()->GetTlsSetting());
@@ -421,9 +441,9 @@ void executor::ex_main()
 			break;
 
 		case EV_PERF_TICK:
-			for (i = 0; i < pvThreads->size(); i++)
-				telem->push_perf_value(i, pvThreads->at(i)->iHashCount.load(std::memory_order_relaxed),
-				pvThreads->at(i)->iTimestamp.load(std::memory_order_relaxed));
+			minethd::stats_snapshot(vThdStats);
+			for (i = 0; i < vThdStats.size(); i++)
+				telem->push_perf_value(i, vThdStats[i].iHashCount, vThdStats[i].iTimestamp);
 
 			if((cnt++ & 0xF) == 0) //Every 16 ticks
 			{
@@ -492,7 +512,7 @@ void executor::hashrate_report(std::string& out)
 	char num[32];
 	size_t nthd = pvThreads->size();
 
-	out.reserve(256 + nthd * 64);
+	out.reserve(256 + nthd * 112);
 
 	double fTotal[3] = { 0.0, 0.0, 0.0};
 	size_t i;
@@ -541,6 +561,47 @@ void executor::hashrate_report(std::string& out)
 	out.append(" H/s\nHighest: ");
 	out.append(hps_format(fHighestHps, num, sizeof(num)));
 	out.append(" H/s\n");
+
+	uint64_t iAborted, iReactUs, iWorstUs;
+	job_switch_stats(iAborted, iReactUs, iWorstUs);
+	snprintf(num, sizeof(num), "%llu", int_port(iAborted));
+	out.append("Aborted: ").append(num).append(" hashes, last job switch took ");
+	snprintf(num, sizeof(num), "%llu", int_port(iReactUs));
+	out.append(num).append(" us to reach all threads (worst ");
+	snprintf(num, sizeof(num), "%llu", int_port(iWorstUs));
+	out.append(num).append(" us)\n");
+
+	uint32_t iHandedOut, iRanges;
+	uint64_t iSplits, iSpentJobs;
+	minethd::nonce_stats(iHandedOut, iRanges, iSplits, iSpentJobs);
+	snprintf(num, sizeof(num), "%u of %u", (unsigned int)iHandedOut, (unsigned int)iRanges);
+	out.append("Nonces:  ").append(num).append(" ranges of the current job taken, ");
+	snprintf(num, sizeof(num), "%llu", int_port(iSplits));
+	out.append(num).append(" ranges split, ");
+	snprintf(num, sizeof(num), "%llu", int_port(iSpentJobs));
+	out.append(num).append(" jobs ran out\n");
+
+	std::vector<minethd::thd_stats> vThdStats;
+	minethd::stats_snapshot(vThdStats);
+	out.append("Kernels:\n");
+	for (i = 0; i < vThdStats.size(); i++)
+	{
+		snprintf(num, sizeof(num), "| %2u | ", (unsigned int)i);
+		out.append(num).append(minethd::kernel_name(vThdStats[i].oKernel));
+		snprintf(num, sizeof(num), " | %llu results, %llu aborted\n",
+			int_port(vThdStats[i].iResultCount), int_port(vThdStats[i].iAbortCount));
+		out.append(num);
+	}
+}
+
+void executor::job_switch_stats(uint64_t& iAborted, uint64_t& iReactUs, uint64_t& iWorstUs)
+{
+	std::vector<minethd::thd_stats> vThdStats;
+	minethd::stats_snapshot(vThdStats);
+	iAborted = 0;
+	for(size_t i=0; i < vThdStats.size(); i++)
+		iAborted += vThdStats[i].iAbortCount;
+	minethd::handoff_stats(iReactUs, iWorstUs);
 }
 
 char* time_format(char* buf, size_t len, std::chrono::system_clock::time_point time)
@@ -840,16 +901,25 @@ void executor::http_json_report(std::string& out)
 {
 	const char *a, *b, *c;
 	char num_a[32], num_b[32], num_c[32];
-	char hr_buffer[64];
-	std::string hr_thds, res_error, cn_error;
+	char hr_buffer[64], ewma_buffer[64], pad_buffer[160];
+	std::string hr_thds, pad_thds, res_error, cn_error;
 
 	size_t nthd = pvThreads->size();
 	double fTotal[3] = { 0.0, 0.0, 0.0};
+	double fEwma[telemetry::iEwmaCount] = { 0.0, 0.0, 0.0};
 	hr_thds.reserve(nthd * 32);
+	pad_thds.reserve(nthd * 64);
 
 	for(size_t i=0; i < nthd; i++)
 	{
 		if(i != 0) hr_thds.append(1, ',');
+		if(i != 0) pad_thds.append(1, ',');
+
+		minethd* thd = pvThreads->at(i);
+		snprintf(pad_buffer, sizeof(pad_buffer), sJsonApiThdScratchpads, (unsigned)thd->iPadPageKb.load(),
+			(unsigned)thd->iPadCount.load(), (unsigned)thd->iHugePadCount.load(), thd->bPadLocked.load() ? "true" : "false",
+			thd->iNumaNode, int_port(thd->iRemotePages.load()));
+		pad_thds.append(pad_buffer);
 
 		double fHps[3];
 		fHps[0] = telem->calc_telemetry_data(2500, i);
@@ -860,6 +930,9 @@ void executor::http_json_report(std::string& out)
 		fTotal[1] += fHps[1];
 		fTotal[2] += fHps[2];
 
+		for(size_t k=0; k < telemetry::iEwmaCount; k++)
+			fEwma[k] += telem->calc_ewma_data(k, i);
+
 		a = hps_format_json(fHps[0], num_a, sizeof(num_a));
 		b = hps_format_json(fHps[1], num_b, sizeof(num_b));
 		c = hps_format_json(fHps[2], num_c, sizeof(num_c));
@@ -872,8 +945,19 @@ void executor::http_json_report(std::string& out)
 	c = hps_format_json(fTotal[2], num_c, sizeof(num_c));
 	snprintf(hr_buffer, sizeof(hr_buffer), sJsonApiThdHashrate, a, b, c);
 
+	a = hps_format_json(fEwma[0], num_a, sizeof(num_a));
+	b = hps_format_json(fEwma[1], num_b, sizeof(num_b));
+	c = hps_format_json(fEwma[2], num_c, sizeof(num_c));
+	snprintf(ewma_buffer, sizeof(ewma_buffer), sJsonApiThdHashrate, a, b, c);
+
 	a = hps_format_json(fHighestHps, num_a, sizeof(num_a));
 
+	uint64_t iAborted, iReactUs, iWorstUs;
+	job_switch_stats(iAborted, iReactUs, iWorstUs);
+	uint32_t iHandedOut, iRanges;
+	uint64_t iSplits, iSpentJobs;
+	minethd::nonce_stats(iHandedOut, iRanges, iSplits, iSpentJobs);
+
 	size_t iGoodRes = vMineResults[0].count, iTotalRes = iGoodRes;
 	size_t ln = vMineResults.size();
 
@@ -927,11 +1011,12 @@ void executor::http_json_report(std::string& out)
 		cn_error.append(buffer);
 	}
 
-	size_t bb_size = 1024 + hr_thds.size() + res_error.size() + cn_error.size();
+	size_t bb_size = 1024 + hr_thds.size() + pad_thds.size() + res_error.size() + cn_error.size();
 	std::unique_ptr<char[]> bigbuf( new char[ bb_size ] );
 
-	int bb_len = snprintf(bigbuf.get(), bb_size, sJsonApiFormat,
-		hr_thds.c_str(), hr_buffer, a,
+	int bb_len = snprintf(bigbuf.get(), bb_size, sJsonApiFormat, minethd::aes_backend_name().c_str(),
+		minethd::kernel_set_name().c_str(), pad_thds.c_str(), hr_thds.c_str(), hr_buffer, ewma_buffer, a, int_port(iAborted), int_port(iReactUs), int_port(iWorstUs),
+		(unsigned int)iHandedOut, (unsigned int)iRanges, int_port(iSplits), int_port(iSpentJobs),
 		int_port(iPoolDiff), int_port(iGoodRes), int_port(iTotalRes), fAvgResTime, int_port(iPoolHashes),
 		int_port(iTopDiff[0]), int_port(iTopDiff[1]), int_port(iTopDiff[2]), int_port(iTopDiff[3]), int_port(iTopDiff[4]),
 		int_port(iTopDiff[5]), int_port(iTopDiff[6]), int_port(iTopDiff[7]), int_port(iTopDiff[8]), int_port(iTopDiff[9]),
@@ -6,6 +6,8 @@
 #include <list>
 #include <future>
 #include <map>
+#include <string>
+#include <unordered_set>
 class jpsock;
 class minethd;
 class telemetry;
@@ -71,6 +73,9 @@ private:
 	void pool_connect(jpsock* pool);
 
 	void hashrate_report(std::string& out);
+	// Aborted hashes of all threads, and how long the last job and the slowest one so far
+	// took to reach every thread
+	void job_switch_stats(uint64_t& iAborted, uint64_t& iReactUs, uint64_t& iWorstUs);
 	void result_report(std::string& out);
 	void connection_report(std::string& out);
 
@@ -134,6 +139,13 @@ private:
 	};
 	std::vector<result_tally> vMineResults;
 
+	// The nonces sent for the job the last result was for. No two threads get the same
+	// nonce range, so a nonce found twice points at a bug and is not sent again.
+	std::string sAuditJobId;
+	std::unordered_set<uint32_t> vAuditNonces;
+	// False if the nonce of the result was already sent for its job
+	bool audit_nonce(const job_result& oResult);
+
 	//More result statistics
 	std::array<size_t, 10> iTopDiff { { } }; //Initialize to zero
 
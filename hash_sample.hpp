@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+// The hashes a thread did by a time in ms and its report before that, which give its
+// rate. The thread reports at least every iStep hashes, so the count at any other
+// instant is known to within one step and samples the threads took at different
+// times can be brought to the same one.
+struct hash_sample
+{
+	uint64_t iHashCount;
+	uint64_t iTimestamp;
+	uint64_t iPrevHashCount;
+	uint64_t iPrevTimestamp;
+	uint64_t iStep;
+
+	// Records the count at iStamp, the last one stays for the rate
+	void report(uint64_t iCount, uint64_t iStamp)
+	{
+		iPrevHashCount = iHashCount;
+		iPrevTimestamp = iTimestamp;
+		iHashCount = iCount;
+		iTimestamp = iStamp;
+	}
+
+	// Records the count of a thread that stops hashing, it holds until the next report
+	void idle(uint64_t iCount, uint64_t iStamp)
+	{
+		iPrevHashCount = iHashCount = iCount;
+		iPrevTimestamp = iTimestamp = iStamp;
+	}
+
+	// The count at iStamp at the rate between the two reports. Before the last report
+	// it lies between the two, after it it stays below the count of the next one.
+	uint64_t at(uint64_t iStamp) const
+	{
+		if (iTimestamp <= iPrevTimestamp)
+			return iHashCount;
+
+		uint64_t iDiff = iHashCount - iPrevHashCount;
+		uint64_t iSpan = iTimestamp - iPrevTimestamp;
+		if (iStamp >= iTimestamp)
+		{
+			uint64_t iAhead = (iStamp - iTimestamp) * iDiff / iSpan;
+			return iHashCount + (iStep != 0 && iAhead >= iStep ? iStep - 1 : iAhead);
+		}
+		if (iStamp <= iPrevTimestamp)
+			return iPrevHashCount;
+		return iPrevHashCount + (iStamp - iPrevTimestamp) * iDiff / iSpan;
+	}
+
+	// Brings the sample to iStamp, so the samples of all threads count up to the same
+	// instant. A thread that never reported keeps timestamp 0. Only for copies, the
+	// rate of the sample is meaningless afterwards.
+	void move_to(uint64_t iStamp)
+	{
+		if (iTimestamp == 0)
+			return;
+		iHashCount = at(iStamp);
+		iTimestamp = iStamp;
+	}
+};
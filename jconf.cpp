@@ -32,11 +32,12 @@
 #ifdef _WIN32
 #define strcasecmp _stricmp
 #include <intrin.h>
-#else
-//#include <cpuid.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
 #endif
 
 #include "console.h"
+#include "crypto/cryptonight.hpp"
 #include "jext.h"
 #include "rapidjson/document.h"
 #include "rapidjson/error/en.h"
@@ -50,8 +51,10 @@ using namespace rapidjson;
 enum configEnum {
   aCpuThreadsConf,
   sUseSlowMem,
+  iPadOffset,
   bNiceHashMode,
   bAesOverride,
+  bAutotune,
   bTlsMode,
   bTlsSecureAlgo,
   sTlsFingerprint,
@@ -79,8 +82,10 @@ struct configVal {
 // kNullType means any type
 configVal oConfigValues[] = {{aCpuThreadsConf, "cpu_threads_conf", kNullType},
                              {sUseSlowMem, "use_slow_memory", kStringType},
+                             {iPadOffset, "scratchpad_offset", kNumberType},
                              {bNiceHashMode, "nicehash_nonce", kTrueType},
                              {bAesOverride, "aes_override", kNullType},
+                             {bAutotune, "autotune", kTrueType},
                              {bTlsMode, "use_tls", kTrueType},
                              {bTlsSecureAlgo, "tls_secure_algo", kTrueType},
                              {sTlsFingerprint, "tls_fingerprint", kStringType},
@@ -144,7 +149,16 @@ bool jconf::GetThreadConfig(size_t id, thd_cfg &cfg) {
   if (mode == nullptr || no_prefetch == nullptr || aff == nullptr)
     return false;
 
-  if (!mode->IsBool() || !no_prefetch->IsBool())
+  if (!mode->IsBool() && !mode->IsNumber())
+    return false;
+
+  if (!no_prefetch->IsBool())
+    return false;
+
+  // low_power_mode is either a boolean (true = 2 ways) or the way count
+  if (mode->IsNumber() &&
+      (!mode->IsUint64() || mode->GetUint64() < 1 ||
+       mode->GetUint64() > cryptonight::Cryptonight::MAX_WAYS))
     return false;
 
   if (!aff->IsNumber() && !aff->IsBool())
@@ -153,7 +167,11 @@ bool jconf::GetThreadConfig(size_t id, thd_cfg &cfg) {
   if (aff->IsNumber() && aff->GetInt64() < 0)
     return false;
 
-  cfg.bDoubleMode = mode->GetBool();
+  if (mode->IsBool())
+    cfg.iMultiway = mode->GetBool() ? 2 : 1;
+  else
+    cfg.iMultiway = (size_t)mode->GetUint64();
+
   cfg.bNoPrefetch = no_prefetch->GetBool();
 
   if (aff->IsNumber())
@@ -179,6 +197,10 @@ jconf::slow_mem_cfg jconf::GetSlowMemSetting() {
     return unknown_value;
 }
 
+size_t jconf::GetScratchpadOffset() {
+  return prv->configValues[iPadOffset]->GetUint64();
+}
+
 bool jconf::GetTlsSetting() { return prv->configValues[bTlsMode]->GetBool(); }
 
 bool jconf::TlsSecureAlgos() {
@@ -244,34 +266,106 @@ bool jconf::NiceHashMode() {
 
 bool jconf::DaemonMode() { return prv->configValues[bDaemonMode]->GetBool(); }
 
+bool jconf::AutoTune() { return prv->configValues[bAutotune]->GetBool(); }
+
 const char *jconf::GetOutputFile() {
   return prv->configValues[sOutputFile]->GetString();
 }
 
 void jconf::cpuid(uint32_t eax, int32_t ecx, int32_t val[4]) {
   memset(val, 0, sizeof(int32_t) * 4);
-  /*
-  #ifdef _WIN32
-          __cpuidex(val, eax, ecx);
-  #else
-          __cpuid_count(eax, ecx, val[0], val[1], val[2], val[3]);
-  #endif*/
+
+#ifdef _WIN32
+  __cpuidex(val, eax, ecx);
+#elif defined(__x86_64__) || defined(__i386__)
+  __cpuid_count(eax, ecx, val[0], val[1], val[2], val[3]);
+#endif
+}
+
+uint64_t jconf::xgetbv(uint32_t ecx) {
+#ifdef _WIN32
+  return _xgetbv(ecx);
+#elif defined(__x86_64__) || defined(__i386__)
+  uint32_t eax, edx;
+  __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(ecx));
+  return (uint64_t(edx) << 32) | eax;
+#else
+  (void)ecx;
+  return 0;
+#endif
 }
 
 bool jconf::check_cpu_features() {
-  /*constexpr int AESNI_BIT = 1 << 25;
+#if defined(_WIN32) || defined(__x86_64__) || defined(__i386__)
+  constexpr int AESNI_BIT = 1 << 25;
+  constexpr int SSSE3_BIT = 1 << 9;
   constexpr int SSE2_BIT = 1 << 26;
-  int32_t cpu_info[4];
-  bool bHaveSse2;
+  constexpr int OSXSAVE_BIT = 1 << 27;
+  constexpr int AVX2_BIT = 1 << 5;
+  constexpr int VAES_BIT = 1 << 9;
+  constexpr uint64_t YMM_STATE = 0x6;
+  constexpr uint64_t ZMM_STATE = 0xe6;
+  // The features of the x86-64 microarchitecture levels, leaf 1 ECX,
+  // leaf 7 EBX and leaf 0x80000001 ECX
+  constexpr int32_t V2_ECX1 = (1 << 0) | (1 << 9) | (1 << 13) | (1 << 19) |
+                              (1 << 20) | (1 << 23);
+  constexpr int32_t V2_ECX81 = 1 << 0;
+  constexpr int32_t V3_ECX1 = (1 << 12) | (1 << 22) | (1 << 28) | (1 << 29);
+  constexpr int32_t V3_EBX7 = (1 << 3) | (1 << 5) | (1 << 8);
+  constexpr int32_t V3_ECX81 = 1 << 5;
+  constexpr int32_t V4_EBX7 = (1 << 16) | (1 << 17) | (1 << 28) | (1 << 30) |
+                              int32_t(1u << 31);
+  int32_t cpu_info[4], ecx1, ebx7 = 0, ecx7 = 0, ecx81 = 0;
+  uint64_t xcr0 = 0;
+  bool bHaveSse2, bHaveYmm;
 
   cpuid(1, 0, cpu_info);
+  ecx1 = cpu_info[2];
 
   bHaveAes = (cpu_info[2] & AESNI_BIT) != 0;
+  bHaveSsse3 = (cpu_info[2] & SSSE3_BIT) != 0;
   bHaveSse2 = (cpu_info[3] & SSE2_BIT) != 0;
 
-  return bHaveSse2;*/
+  // The 256 and 512 bit registers only count if the OS saves them too
+  if ((ecx1 & OSXSAVE_BIT) != 0)
+    xcr0 = xgetbv(0);
+  bHaveYmm = (xcr0 & YMM_STATE) == YMM_STATE;
+
+  cpuid(0, 0, cpu_info);
+  if (cpu_info[0] >= 7) {
+    cpuid(7, 0, cpu_info);
+    ebx7 = cpu_info[1];
+    ecx7 = cpu_info[2];
+  }
+  cpuid(0x80000000, 0, cpu_info);
+  if (uint32_t(cpu_info[0]) >= 0x80000001) {
+    cpuid(0x80000001, 0, cpu_info);
+    ecx81 = cpu_info[2];
+  }
+
+  bHaveVaes = bHaveAes && bHaveYmm && (ebx7 & AVX2_BIT) != 0 &&
+              (ecx7 & VAES_BIT) != 0;
+
+  iIsaLevel = 1;
+  if ((ecx1 & V2_ECX1) == V2_ECX1 && (ecx81 & V2_ECX81) == V2_ECX81) {
+    iIsaLevel = 2;
+    if (bHaveYmm && (ecx1 & V3_ECX1) == V3_ECX1 &&
+        (ebx7 & V3_EBX7) == V3_EBX7 && (ecx81 & V3_ECX81) == V3_ECX81) {
+      iIsaLevel = 3;
+      if ((xcr0 & ZMM_STATE) == ZMM_STATE && (ebx7 & V4_EBX7) == V4_EBX7)
+        iIsaLevel = 4;
+    }
+  }
+
+  return bHaveSse2;
+#else
+  // The other backends have no runtime check, they are built for the host
   bHaveAes = true;
+  bHaveSsse3 = false;
+  bHaveVaes = false;
+  iIsaLevel = 0;
   return true;
+#endif
 }
 
 bool jconf::parse_config(const char *sFilename) {
@@ -374,12 +468,6 @@ bool jconf::parse_config(const char *sFilename) {
     }
   }
 
-  if (NiceHashMode() && GetThreadCount() >= 32) {
-    printer::inst()->print_msg(
-        L0, "You need to use less than 32 threads in NiceHash mode.");
-    return false;
-  }
-
   if (GetSlowMemSetting() == unknown_value) {
     printer::inst()->print_msg(L0, "Invalid config file. use_slow_memory must "
                                    "be \"always\", \"no_mlck\", \"warn\" or "
@@ -387,6 +475,14 @@ bool jconf::parse_config(const char *sFilename) {
     return false;
   }
 
+  if (!prv->configValues[iPadOffset]->IsUint64() ||
+      GetScratchpadOffset() % 64 != 0 ||
+      GetScratchpadOffset() >= cryptonight::Cryptonight::MEMORY) {
+    printer::inst()->print_msg(L0, "Invalid config file. scratchpad_offset "
+                                   "must be a multiple of 64 below 2097152.");
+    return false;
+  }
+
   if (!prv->configValues[iCallTimeout]->IsUint64() ||
       !prv->configValues[iNetRetry]->IsUint64() ||
       !prv->configValues[iGiveUpLimit]->IsUint64()) {
@@ -429,9 +525,24 @@ bool jconf::parse_config(const char *sFilename) {
   }
 #endif // _WIN32
 
+  if (!prv->configValues[bAesOverride]->IsNull() &&
+      !prv->configValues[bAesOverride]->IsBool()) {
+    printer::inst()->print_msg(
+        L0, "Invalid config file. aes_override must be true, false or null.");
+    return false;
+  }
+
   printer::inst()->set_verbose_level(
       prv->configValues[iVerboseLevel]->GetUint64());
-  bHaveAes = true;
+
+  if (!check_cpu_features()) {
+    printer::inst()->print_msg(L0, "CPU support of SSE2 is required.");
+    return false;
+  }
+
+  if (prv->configValues[bAesOverride]->IsBool())
+    bHaveAes = prv->configValues[bAesOverride]->GetBool();
+  bHaveVaes = bHaveVaes && bHaveAes;
   if (NeedsAutoconf())
     return true;
 
@@ -14,7 +14,7 @@ public:
 	bool parse_config(const char* sFilename);
 
 	struct thd_cfg {
-		bool bDoubleMode;
+		size_t iMultiway;
 		bool bNoPrefetch;
 		long long iCpuAff;
 	};
@@ -32,6 +32,8 @@ public:
 	bool NeedsAutoconf();
 
 	slow_mem_cfg GetSlowMemSetting();
+	// Bytes between two scratchpads of one mapping, staggers them over the cache sets
+	size_t GetScratchpadOffset();
 
 	bool GetTlsSetting();
 	bool TlsSecureAlgos();
@@ -56,11 +58,19 @@ public:
 
 	bool DaemonMode();
 
+	// Measure the hash kernels at startup instead of taking them from the thread config
+	bool AutoTune();
+
 	bool PreferIpv4();
 
 	inline bool HaveHardwareAes() { return bHaveAes; }
+	inline bool HaveSsse3() { return bHaveSsse3; }
+	inline bool HaveVaes() { return bHaveVaes; }
+	// The x86-64 microarchitecture level (1 to 4) of the CPU, 0 elsewhere
+	inline int GetIsaLevel() { return iIsaLevel; }
 
 	static void cpuid(uint32_t eax, int32_t ecx, int32_t val[4]);
+	static uint64_t xgetbv(uint32_t ecx);
 
 private:
 	jconf();
@@ -71,4 +81,7 @@ private:
 	opaque_private* prv;
 
 	bool bHaveAes;
+	bool bHaveSsse3;
+	bool bHaveVaes;
+	int iIsaLevel;
 };
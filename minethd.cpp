@@ -23,15 +23,18 @@
   */
 
 #include "console.h"
+#include <algorithm>
 #include <assert.h>
 #include <bitset>
 #include <chrono>
 #include <cmath>
 #include <cstring>
+#include <future>
 #include <map>
 #include <stdio.h>
 #include <thread>
 #include <iostream>
+#include <vector>
 #ifdef _WIN32
 #include <windows.h>
 
@@ -70,138 +73,551 @@ void thd_setaffinity(std::thread::native_handle_type h, uint64_t cpu_id) {
 }
 #endif // _WIN32
 
+#include "autotune.h"
 #include "crypto/cryptonight.hpp"
 #include "executor.h"
 #include "hwlocMemory.hpp"
 #include "jconf.h"
 #include "minethd.h"
 
+minethd::cn_backend minethd::backend_selector() {
 #ifdef __x86_64
-#include "cryptonight_aesni.hpp"
-#elif __PPC64__
-#include "cryptonight_altivec.hpp"
-#elif __sparcv9
-#include "cryptonight_sparc.hpp"
+  if (jconf::inst()->HaveVaes())
+    return cn_vaes;
 #endif
+  if (jconf::inst()->HaveHardwareAes())
+    return cn_hw_aes;
+#ifdef __x86_64
+  if (jconf::inst()->HaveSsse3())
+    return cn_ssse3;
+#endif
+  return cn_generic;
+}
 
-telemetry::telemetry(size_t iThd) {
-  ppHashCounts = new uint64_t *[iThd];
-  ppTimestamps = new uint64_t *[iThd];
-  iBucketTop = new uint32_t[iThd];
-
-  for (size_t i = 0; i < iThd; i++) {
-    ppHashCounts[i] = new uint64_t[iBucketSize];
-    ppTimestamps[i] = new uint64_t[iBucketSize];
-    iBucketTop[i] = 0;
-    memset(ppHashCounts[0], 0, sizeof(uint64_t) * iBucketSize);
-    memset(ppTimestamps[0], 0, sizeof(uint64_t) * iBucketSize);
+// How the backend computes AES, for the banner and the reports
+static const char *backend_name(minethd::cn_backend backend) {
+  switch (backend) {
+  case minethd::cn_vaes:
+    return "VAES";
+  case minethd::cn_hw_aes:
+    return "hardware AES";
+  case minethd::cn_ssse3:
+    return "SSSE3 AES";
+  case minethd::cn_generic:
+    break;
   }
+  return "table AES";
 }
 
-double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread) {
-  using namespace std::chrono;
-  uint64_t iTimeNow =
-      time_point_cast<milliseconds>(high_resolution_clock::now())
-          .time_since_epoch()
-          .count();
-
-  uint64_t iEarliestHashCnt = 0;
-  uint64_t iEarliestStamp = 0;
-  uint64_t iLastestStamp = 0;
-  uint64_t iLastestHashCnt = 0;
-  char bHaveFullSet = 0;
-
-  // Start at 1, buckettop points to next empty
-  for (size_t i = 1; i < iBucketSize; i++) {
-    size_t idx =
-        (iBucketTop[iThread] - i) & iBucketMask; // overflow expected here
-
-    if (ppTimestamps[iThread][idx] == 0)
-      break; // That means we don't have the data yet
-
-    if (iLastestStamp == 0) {
-      iLastestStamp = ppTimestamps[iThread][idx];
-      iLastestHashCnt = ppHashCounts[iThread][idx];
-    }
+// How the backend is written in the autotune cache
+static const char *backend_id(minethd::cn_backend backend) {
+  switch (backend) {
+  case minethd::cn_vaes:
+    return "vaes";
+  case minethd::cn_hw_aes:
+    return "hw_aes";
+  case minethd::cn_ssse3:
+    return "ssse3";
+  case minethd::cn_generic:
+    break;
+  }
+  return "generic";
+}
+
+// Where the autotuner keeps its choice, in the working directory like config.txt
+static const char *sAutotuneFile = "autotune.txt";
+
+// The backends the CPU and aes_override allow, the fastest one by design first
+static std::vector<minethd::cn_backend> available_backends() {
+  std::vector<minethd::cn_backend> vBackends;
+#ifdef __x86_64
+  if (jconf::inst()->HaveVaes())
+    vBackends.push_back(minethd::cn_vaes);
+#endif
+  if (jconf::inst()->HaveHardwareAes())
+    vBackends.push_back(minethd::cn_hw_aes);
+#ifdef __x86_64
+  if (jconf::inst()->HaveSsse3())
+    vBackends.push_back(minethd::cn_ssse3);
+#endif
+  vBackends.push_back(minethd::cn_generic);
+  return vBackends;
+}
+
+const cryptonight::KernelSet &minethd::kernel_set_selector() {
+  return cryptonight::KernelSet::best(jconf::inst()->GetIsaLevel());
+}
+
+std::string minethd::aes_backend_name() {
+  return backend_name(backend_selector());
+}
+
+std::string minethd::kernel_set_name() {
+  return kernel_set_selector().name;
+}
+
+// The backend as the kernel sets know it
+static cryptonight::KernelSet::Backend
+kernel_backend(minethd::cn_backend backend) {
+  using cryptonight::KernelSet;
+  switch (backend) {
+  case minethd::cn_vaes:
+    return KernelSet::VAES;
+  case minethd::cn_hw_aes:
+    return KernelSet::HW_AES;
+  case minethd::cn_ssse3:
+    return KernelSet::SSSE3;
+  case minethd::cn_generic:
+    break;
+  }
+  return KernelSet::GENERIC;
+}
+
+std::string minethd::kernel_name(const kernel_variant &kernel) {
+  return std::string(backend_name(kernel.backend)) + ", " +
+         std::to_string(kernel.iWays) +
+         (kernel.iWays == 1 ? " way, " : " ways, ") +
+         (kernel.bNoPrefetch ? "no prefetch" : "prefetch");
+}
+
+// An empty scratchpad gives the context slow memory of its own
+std::unique_ptr<cryptonight::Context>
+make_context(minethd::cn_backend backend,
+             const cryptonight::Scratchpad &pad = cryptonight::Scratchpad()) {
+  return minethd::kernel_set_selector().make(kernel_backend(backend), pad);
+}
+
+cryptonight::ScratchpadArena::Policy scratchpad_policy() {
+  using arena = cryptonight::ScratchpadArena;
+  switch (jconf::inst()->GetSlowMemSetting()) {
+  case jconf::always_use:
+    return arena::SLOW_MEMORY;
+  case jconf::print_warning:
+    return arena::HUGE_OR_SLOW;
+  case jconf::no_mlck:
+    return arena::HUGE_NO_MLOCK;
+  default:
+    return arena::HUGE_ONLY;
+  }
+}
+
+// Maps n scratchpads as use_slow_memory says, or exits when it does not
+// allow the memory the system has. sOwner names the thread or node.
+static std::shared_ptr<cryptonight::ScratchpadArena>
+map_scratchpads(size_t n, size_t colour, const std::string &sOwner) {
+  using arena = cryptonight::ScratchpadArena;
+  std::shared_ptr<arena> pads;
+  try {
+    // 1 GB pages are only tried when the administrator reserved some
+    const size_t size = cryptonight::Cryptonight::MEMORY;
+    pads = std::make_shared<arena>(n, size, scratchpad_policy(), true, colour);
+  } catch (const cryptonight::Exception &e) {
+    printer::inst()->print_msg(L0, "ERROR: %s: %s. Exiting.", sOwner.c_str(),
+                               e.what());
+    exit(1);
+  }
+
+  if (pads->fellBack())
+    printer::inst()->print_msg(L0, "WARNING: %s: No huge pages for the "
+                                   "scratchpads, using slow memory.",
+                               sOwner.c_str());
+  return pads;
+}
+
+// Fills pads with the n scratchpads of a thread, out of the slab of its node
+// or out of a mapping of its own, and tells where in there they start
+static std::shared_ptr<cryptonight::ScratchpadArena>
+take_scratchpads(const minethd::pad_plan &plan, size_t n, size_t iThd,
+                 cryptonight::Scratchpad *pads, size_t &first) {
+  std::shared_ptr<cryptonight::ScratchpadArena> mem = plan.pSlab;
+  first = plan.iFirst;
+  if (!mem) {
+    mem = map_scratchpads(n, plan.iColour, "Thread " + std::to_string(iThd));
+    first = 0;
+  }
 
-    if (iTimeNow - ppTimestamps[iThread][idx] > iLastMilisec) {
-      bHaveFullSet = true;
-      break; // We are out of the requested time period
+  for (size_t i = 0; i < n; i++)
+    pads[i] = cryptonight::Scratchpad(mem, first + i);
+  return mem;
+}
+
+std::vector<minethd::pad_plan> minethd::plan_scratchpads(size_t iColour) {
+  size_t i, n = jconf::inst()->GetThreadCount();
+  const std::vector<kernel_variant> &vKernel = select_kernels(false);
+  jconf::thd_cfg cfg;
+
+  // The threads pinned to one NUMA node share a slab of scratchpads, every
+  // other thread gets a mapping of its own
+  struct slab_job {
+    int iNode;
+    int64_t iCpu;
+    size_t iCount;
+    std::string sOwner;
+  };
+  std::vector<pad_plan> vPlan(n, pad_plan{nullptr, 0, -1, iColour});
+  std::vector<slab_job> vJobs;
+  std::vector<size_t> vJobOf(n);
+  std::map<int, size_t> mNodeJob;
+  for (i = 0; i < n; i++) {
+    jconf::inst()->GetThreadConfig(i, cfg);
+    if (cfg.iCpuAff >= 0)
+      vPlan[i].iNode = numaNodeOfPU(cfg.iCpuAff);
+
+    int iNode = vPlan[i].iNode;
+    if (iNode >= 0 && mNodeJob.count(iNode) != 0) {
+      vJobOf[i] = mNodeJob[iNode];
+    } else {
+      vJobOf[i] = vJobs.size();
+      vJobs.push_back({iNode, cfg.iCpuAff, 0,
+                       iNode >= 0 ? "NUMA node " + std::to_string(iNode)
+                                  : "Thread " + std::to_string(i)});
+      if (iNode >= 0)
+        mNodeJob[iNode] = vJobOf[i];
     }
+    vPlan[i].iFirst = vJobs[vJobOf[i]].iCount;
+    vJobs[vJobOf[i]].iCount += vKernel[i].iWays;
+  }
 
-    iEarliestStamp = ppTimestamps[iThread][idx];
-    iEarliestHashCnt = ppHashCounts[iThread][idx];
+  // Map, lock and fault in all of them at once before any miner thread
+  // starts, each from a thread pinned where its scratchpads are used so
+  // every page starts out on the right NUMA node
+  std::vector<std::shared_ptr<cryptonight::ScratchpadArena>> vSlabs(
+      vJobs.size());
+  std::vector<std::promise<void>> vPinned(vJobs.size());
+  std::vector<std::thread> vThds;
+  for (size_t j = 0; j < vJobs.size(); j++) {
+    vThds.emplace_back([&, j] {
+      vPinned[j].get_future().wait();
+      if (vJobs[j].iCpu >= 0)
+        bindMemoryToNUMANode(vJobs[j].iCpu);
+      vSlabs[j] = map_scratchpads(vJobs[j].iCount, iColour, vJobs[j].sOwner);
+      vSlabs[j]->touch();
+    });
+    if (vJobs[j].iCpu >= 0)
+      thd_setaffinity(vThds.back().native_handle(), vJobs[j].iCpu);
+    vPinned[j].set_value();
   }
+  for (std::thread &thd : vThds)
+    thd.join();
 
-  if (!bHaveFullSet || iEarliestStamp == 0 || iLastestStamp == 0)
-    return nan("");
+  for (size_t j = 0; j < vJobs.size(); j++) {
+    if (vJobs[j].iNode < 0)
+      continue;
+    size_t off = 0;
+    for (size_t k = 0; k < vJobs[j].iCount; k++)
+      off += vSlabs[j]->pagesOffNode(k, vJobs[j].iNode);
+    printer::inst()->print_msg(
+        L1, "NUMA node %d: %llu scratchpads reserved, %llu pages off the node.",
+        vJobs[j].iNode, int_port(vJobs[j].iCount), int_port(off));
+  }
 
-  // Don't think that can happen, but just in case
-  if (iLastestStamp - iEarliestStamp == 0)
-    return nan("");
+  for (i = 0; i < n; i++)
+    vPlan[i].pSlab = vSlabs[vJobOf[i]];
+  return vPlan;
+}
 
-  double fHashes, fTime;
-  fHashes = iLastestHashCnt - iEarliestHashCnt;
-  fTime = iLastestStamp - iEarliestStamp;
-  fTime /= 1000.0;
+void minethd::alloc_scratchpads(cryptonight::Scratchpad *pads, size_t n) {
+  using arena = cryptonight::ScratchpadArena;
+  size_t first;
+  auto mem = take_scratchpads(oPads, n, iThreadNo, pads, first);
+  oPads.pSlab.reset();
+
+  uint32_t huge = 0;
+  uint64_t off = 0;
+  for (size_t i = first; i < first + n; i++) {
+    huge += mem->hugeBytes(i) == mem->size();
+    if (iNumaNode >= 0)
+      off += mem->pagesOffNode(i, iNumaNode);
+  }
 
-  return fHashes / fTime;
+  iPadPageKb = (uint32_t)(mem->pageSize() / 1024);
+  iPadCount = (uint32_t)n;
+  iHugePadCount = huge;
+  bPadLocked = mem->locked();
+  iRemotePages = off;
+
+  const char *pages = mem->pageSize() == arena::GIGANTIC_PAGE ? "1 GB pages"
+                      : mem->pageSize() == arena::HUGE_PAGE   ? "2 MB pages"
+                                                              : "slow memory";
+  const char *locked = mem->locked() ? ", locked" : "";
+  if (iNumaNode >= 0)
+    printer::inst()->print_msg(L1,
+                               "Thread %d: %u of %u scratchpads on huge pages "
+                               "(%s%s), %llu pages off NUMA node %d.",
+                               (int)iThreadNo, huge, (unsigned)n, pages,
+                               locked, int_port(off), iNumaNode);
+  else
+    printer::inst()->print_msg(
+        L1, "Thread %d: %u of %u scratchpads on huge pages (%s%s).",
+        (int)iThreadNo, huge, (unsigned)n, pages, locked);
 }
 
-void telemetry::push_perf_value(size_t iThd, uint64_t iHashCount,
-                                uint64_t iTimestamp) {
-  size_t iTop = iBucketTop[iThd];
-  ppHashCounts[iThd][iTop] = iHashCount;
-  ppTimestamps[iThd][iTop] = iTimestamp;
+// The contexts handed to the returned functions must come from make_context
+minethd::cn_hash_fun minethd::func_ways_selector(cn_backend backend,
+                                                 bool bNoPrefetch,
+                                                 size_t iWays) {
+  return kernel_set_selector().hash(kernel_backend(backend), bNoPrefetch,
+                                    iWays);
+}
 
-  iBucketTop[iThd] = (iTop + 1) & iBucketMask;
+minethd::cn_next_fun minethd::func_next_selector(cn_backend backend,
+                                                 bool bNoPrefetch) {
+  return kernel_set_selector().next(kernel_backend(backend), bNoPrefetch);
 }
 
-std::unique_ptr<cryptonight::Cryptonight> make_context() {
-  using type = std::unique_ptr<cryptonight::Cryptonight>;
-  if (jconf::inst()->HaveHardwareAes()) {
-#ifdef __x86_64
-    return type(new cryptonight::CryptonightAESNI);
-#elif __PPC64__
-    return type(new cryptonight::CryptonightAltivec);
-#elif __sparcv9
-    return type(new cryptonight::CryptonightSparc);
-#endif
+double minethd::measure_kernel(const kernel_variant &kernel,
+                               cryptonight::Scratchpad *pads, size_t iMs) {
+  using namespace std::chrono;
+  using cryptonight::Context;
+  using cryptonight::Cryptonight;
+  std::unique_ptr<Context> ctx[Cryptonight::MAX_WAYS];
+  Context *ctxp[Cryptonight::MAX_WAYS];
+  for (size_t i = 0; i < kernel.iWays; i++) {
+    ctx[i] = make_context(kernel.backend, pads[i]);
+    ctxp[i] = ctx[i].get();
+  }
+
+  // Hash the way the miner threads do, a single one with consecutive nonces
+  cn_hash_fun hash_fun =
+      func_ways_selector(kernel.backend, kernel.bNoPrefetch, kernel.iWays);
+  cn_next_fun hash_next =
+      func_next_selector(kernel.backend, kernel.bNoPrefetch);
+  uint8_t bWork[sizeof(miner_work::bWorkBlob) * Cryptonight::MAX_WAYS] = {0};
+  ctx[0]->setBlob(bWork, 76);
+  uint32_t iNonce = 0;
+  auto round = [&] {
+    if (kernel.iWays == 1)
+      hash_next(ctxp[0], ++iNonce);
+    else
+      hash_fun(ctxp, bWork, 76);
+  };
+
+  // The first round faults the scratchpads in and warms the caches
+  round();
+  uint64_t iCount = 0;
+  auto start = steady_clock::now();
+  auto end = start + milliseconds(iMs);
+  auto now = start;
+  while ((now = steady_clock::now()) < end) {
+    round();
+    iCount += kernel.iWays;
+  }
+  return iCount / duration<double>(now - start).count();
+}
+
+std::vector<minethd::kernel_variant>
+minethd::tune_kernels(std::vector<double> &vHps) {
+  using cryptonight::Cryptonight;
+  const size_t iMs = 2000;
+  size_t n = jconf::inst()->GetThreadCount();
+  size_t iColour = jconf::inst()->GetScratchpadOffset();
+  std::vector<cn_backend> vBackends = available_backends();
+  std::vector<kernel_variant> vBest(n);
+  std::vector<std::promise<void>> vPinned(n);
+  std::vector<std::thread> vThds;
+  vHps.assign(n, 0.0);
+
+  size_t iMaxWays = 1;
+  for (size_t i = 0; i < n; i++) {
+    jconf::thd_cfg cfg;
+    jconf::inst()->GetThreadConfig(i, cfg);
+    iMaxWays = std::max(iMaxWays, cfg.iMultiway);
+  }
+  printer::inst()->print_msg(
+      L0, "Autotuning the hash kernels, this takes about %llu seconds...",
+      int_port((vBackends.size() + iMaxWays) * iMs / 1000));
+
+  for (size_t i = 0; i < n; i++) {
+    jconf::thd_cfg cfg;
+    jconf::inst()->GetThreadConfig(i, cfg);
+
+    // All threads measure at once, so every kernel sees the cache and memory
+    // bandwidth it will have to share while mining
+    vThds.emplace_back([&, i, cfg] {
+      vPinned[i].get_future().wait();
+      if (cfg.iCpuAff >= 0)
+        bindMemoryToNUMANode(cfg.iCpuAff);
+
+      cryptonight::Scratchpad pads[Cryptonight::MAX_WAYS];
+      size_t first;
+      take_scratchpads(pad_plan{nullptr, 0, -1, iColour}, cfg.iMultiway, i,
+                       pads, first);
+
+      kernel_variant best = {vBackends.front(), 1, false};
+      double fBest = 0.0;
+      auto attempt = [&](const kernel_variant &kernel) {
+        double fHps = measure_kernel(kernel, pads, iMs);
+        if (fHps > fBest) {
+          fBest = fHps;
+          best = kernel;
+        }
+      };
+
+      // The backend first, then the ways with it, then the prefetch
+      for (cn_backend backend : vBackends)
+        attempt({backend, 1, false});
+      for (size_t w = 2; w <= cfg.iMultiway; w++)
+        attempt({best.backend, w, false});
+      attempt({best.backend, best.iWays, true});
+
+      vBest[i] = best;
+      vHps[i] = fBest;
+    });
+
+    if (cfg.iCpuAff >= 0)
+      thd_setaffinity(vThds.back().native_handle(), cfg.iCpuAff);
+    vPinned[i].set_value();
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    vThds[i].join();
+    printer::inst()->print_msg(L1, "Thread %d: %s, %.1f H/s.", (int)i,
+                               kernel_name(vBest[i]).c_str(), vHps[i]);
+  }
+  return vBest;
+}
+
+const std::vector<minethd::kernel_variant> &
+minethd::select_kernels(bool bRetune) {
+  if (!vKernels.empty() && !bRetune)
+    return vKernels;
+
+  size_t i, n = jconf::inst()->GetThreadCount();
+  std::vector<jconf::thd_cfg> vCfg(n);
+  for (i = 0; i < n; i++)
+    jconf::inst()->GetThreadConfig(i, vCfg[i]);
+
+  vKernels.clear();
+  if (!jconf::inst()->AutoTune()) {
+    for (i = 0; i < n; i++)
+      vKernels.push_back({backend_selector(), vCfg[i].iMultiway,
+                          vCfg[i].bNoPrefetch});
+    return vKernels;
+  }
+
+  // The cache only holds while every thread has the config it was tuned with
+  // and the backend it picked is still allowed
+  std::vector<cn_backend> vBackends = available_backends();
+  std::vector<std::string> vIds;
+  for (cn_backend b : vBackends)
+    vIds.push_back(backend_id(b));
+  std::vector<autotune_cache::entry> vCache;
+  bool bCached = !bRetune && autotune_cache::load(sAutotuneFile, n, vCache);
+  for (i = 0; bCached && i < n; i++) {
+    const autotune_cache::entry &e = vCache[i];
+    bCached = autotune_cache::fits(e, vCfg[i].iCpuAff, vCfg[i].iMultiway, vIds);
+    if (bCached) {
+      size_t b = std::find(vIds.begin(), vIds.end(), e.sBackend) - vIds.begin();
+      vKernels.push_back({vBackends[b], e.iWays, e.bNoPrefetch});
+    }
   }
-  return type(new cryptonight::Cryptonight);
+
+  if (bCached) {
+    printer::inst()->print_msg(L0, "Using the hash kernels tuned earlier on "
+                                   "this host, start with --retune to "
+                                   "measure them again.");
+    return vKernels;
+  }
+
+  std::vector<double> vHps;
+  vKernels = tune_kernels(vHps);
+  vCache.clear();
+  for (i = 0; i < n; i++)
+    vCache.push_back({vCfg[i].iCpuAff, vCfg[i].iMultiway,
+                      backend_id(vKernels[i].backend), vKernels[i].iWays,
+                      vKernels[i].bNoPrefetch, vHps[i]});
+  if (!autotune_cache::save(sAutotuneFile, vCache))
+    printer::inst()->print_msg(L0, "WARNING: Could not write %s, the kernels "
+                                   "will be measured again next time.",
+                               sAutotuneFile);
+  return vKernels;
 }
 
-minethd::minethd(miner_work &pWork, size_t iNo, char double_work,
-                 char no_prefetch, int64_t affinity) {
+minethd::minethd(miner_work &pWork, size_t iNo, const kernel_variant &kernel,
+                 int64_t affinity, const pad_plan &pads) {
   oWork = pWork;
   bQuit = 0;
-  iThreadNo = (uint8_t)iNo;
-  iJobNo = 0;
-  iHashCount = 0;
-  iTimestamp = 0;
-  bNoPrefetch = no_prefetch;
+  iThreadNo = iNo;
+  iJobNo = oGlobalWork.version();
+  iNonceBase = 0;
+  oStats = thd_stats();
+  // The threads report every 16 rounds
+  oStats.iStep = 16 * kernel.iWays;
+  oStats.oKernel = kernel;
+  oStatsCell.write(oStats);
+  iPadPageKb = 0;
+  iPadCount = 0;
+  iHugePadCount = 0;
+  bPadLocked = false;
+  iRemotePages = 0;
+  iNumaNode = pads.iNode;
+  oPads = pads;
+  bCancelHash = false;
+  oKernel = kernel;
   this->affinity = affinity;
 
-  if (double_work)
-    oWorkThd = std::thread(&minethd::double_work_main, this);
-  else
+  switch (kernel.iWays) {
+  case 5:
+    oWorkThd = std::thread(&minethd::multiway_work_main<5>, this);
+    break;
+  case 4:
+    oWorkThd = std::thread(&minethd::multiway_work_main<4>, this);
+    break;
+  case 3:
+    oWorkThd = std::thread(&minethd::multiway_work_main<3>, this);
+    break;
+  case 2:
+    oWorkThd = std::thread(&minethd::multiway_work_main<2>, this);
+    break;
+  case 1:
+  default:
     oWorkThd = std::thread(&minethd::work_main, this);
+    break;
+  }
 }
 
-std::atomic<uint64_t> minethd::iGlobalJobNo;
 std::atomic<uint64_t>
     minethd::iConsumeCnt; // Threads get jobs as they are initialized
-minethd::miner_work minethd::oGlobalWork;
+seqslot<minethd::miner_work> minethd::oGlobalWork;
+nonce_dispenser minethd::oNonces;
+std::atomic<uint64_t> minethd::iRangeSplits(0);
+std::atomic<uint64_t> minethd::iSpentJobs(0);
 uint64_t minethd::iThreadCount = 0;
+std::map<int, minethd *> *minethd::pvAllThreads = nullptr;
+std::atomic<uint64_t> minethd::iSwitchTimestamp;
+std::atomic<uint64_t> minethd::iHandoffUs;
+std::atomic<uint64_t> minethd::iHandoffWorstUs;
+uint64_t minethd::iStartTimestamp = 0;
+std::atomic<bool> minethd::bFirstHash(false);
+std::vector<minethd::kernel_variant> minethd::vKernels;
+
+static uint64_t get_timestamp_us() {
+  using namespace std::chrono;
+  return time_point_cast<microseconds>(steady_clock::now())
+      .time_since_epoch()
+      .count();
+}
+
+// In ms of the clock the telemetry and the benchmark read as well
+static uint64_t get_timestamp_ms() {
+  using namespace std::chrono;
+  return time_point_cast<milliseconds>(high_resolution_clock::now())
+      .time_since_epoch()
+      .count();
+}
 
 char minethd::self_test() {
   size_t res;
   char fatal = false;
 
-  auto ctx0 = make_context();
+  cn_backend backend = backend_selector();
+  auto ctx0 = make_context(backend);
+  cryptonight::Context *ctxp = ctx0.get();
 
-  auto out1 = ctx0->calculateResult(
-      reinterpret_cast<const uint8_t *>("This is a test"), 14);
+  // Check the kernel the threads will actually run
+  func_selector(backend, false)(
+      &ctxp, reinterpret_cast<const uint8_t *>("This is a test"), 14);
+  auto &out1 = ctx0->result();
   auto bResult = memcmp(out1, "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b"
                               "\x60\xd4\x35\x54\xae\x10\x58\x02\xc5\xf5\xd8\xa9"
                               "\xb3\x25\x36\x49\xc0\xbe\x66\x05",
@@ -218,55 +634,239 @@ char minethd::self_test() {
 }
 
 std::map<int, minethd *> *minethd::thread_starter(miner_work &pWork) {
-  iGlobalJobNo = 0;
+  iStartTimestamp = get_timestamp_us();
+  bFirstHash = false;
   iConsumeCnt = 0;
   std::map<int, minethd *> *pvThreads = new std::map<int, minethd *>;
+  pvAllThreads = pvThreads;
 
   // Launch the requested number of single and double threads, to distribute
   // load evenly we need to alternate single and double threads
   size_t i, n = jconf::inst()->GetThreadCount();
 
   jconf::thd_cfg cfg;
+  const std::vector<kernel_variant> &vKernel = select_kernels(false);
+  std::vector<pad_plan> vPads =
+      plan_scratchpads(jconf::inst()->GetScratchpadOffset());
+
   for (i = 0; i < n; i++) {
     jconf::inst()->GetThreadConfig(i, cfg);
 
-    minethd *thd =
-        new minethd(pWork, i, cfg.bDoubleMode, cfg.bNoPrefetch, cfg.iCpuAff);
+    minethd *thd = new minethd(pWork, i, vKernel[i], cfg.iCpuAff, vPads[i]);
     (*pvThreads)[i] = thd;
 
     if (cfg.iCpuAff >= 0)
-      printer::inst()->print_msg(L1, "Starting %s thread, affinity: %d.",
-                                 cfg.bDoubleMode ? "double" : "single",
-                                 (int)cfg.iCpuAff);
+      printer::inst()->print_msg(L1, "Starting %dx thread, affinity: %d.",
+                                 (int)vKernel[i].iWays, (int)cfg.iCpuAff);
     else
-      printer::inst()->print_msg(L1, "Starting %s thread, no affinity.",
-                                 cfg.bDoubleMode ? "double" : "single");
+      printer::inst()->print_msg(L1, "Starting %dx thread, no affinity.",
+                                 (int)vKernel[i].iWays);
   }
 
+  // Every thread counts itself in once its contexts are set up, wait for all
+  // of them so the first job does not wait for any
+  while (iConsumeCnt.load(std::memory_order_seq_cst) < n)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  printer::inst()->print_msg(L1, "%llu threads ready to hash after %llu ms.",
+                             int_port(n),
+                             int_port((get_timestamp_us() - iStartTimestamp) /
+                                      1000));
+
   iThreadCount = n;
   return pvThreads;
 }
 
+void minethd::note_first_hash() {
+  bool bDone = false;
+  if (!bFirstHash.compare_exchange_strong(bDone, true))
+    return;
+  printer::inst()->print_msg(
+      L1, "Time to first hash: %llu ms after startup.",
+      int_port((get_timestamp_us() - iStartTimestamp) / 1000));
+}
+
+double minethd::layout_benchmark(size_t iColour, size_t iSeconds) {
+  using namespace std::chrono;
+  using cryptonight::Cryptonight;
+  size_t n = jconf::inst()->GetThreadCount();
+  const std::vector<kernel_variant> &vKernel = select_kernels(false);
+  std::vector<pad_plan> vPads = plan_scratchpads(iColour);
+  std::vector<std::promise<void>> vPinned(n);
+  std::vector<std::thread> vThds;
+  std::vector<double> vHps(n, 0.0);
+  std::atomic<bool> bStop(false);
+
+  for (size_t i = 0; i < n; i++) {
+    jconf::thd_cfg cfg;
+    jconf::inst()->GetThreadConfig(i, cfg);
+
+    // The same placement as the miner threads, only the offset differs
+    vThds.emplace_back([&, i, cfg] {
+      vPinned[i].get_future().wait();
+      if (cfg.iCpuAff >= 0)
+        bindMemoryToNUMANode(cfg.iCpuAff);
+
+      const kernel_variant &kernel = vKernel[i];
+      cryptonight::Scratchpad pads[Cryptonight::MAX_WAYS];
+      std::unique_ptr<cryptonight::Context> ctx[Cryptonight::MAX_WAYS];
+      cryptonight::Context *ctxp[Cryptonight::MAX_WAYS];
+      size_t first;
+      take_scratchpads(vPads[i], kernel.iWays, i, pads, first);
+      for (size_t j = 0; j < kernel.iWays; j++) {
+        ctx[j] = make_context(kernel.backend, pads[j]);
+        ctxp[j] = ctx[j].get();
+      }
+      cn_hash_fun hash_fun =
+          func_ways_selector(kernel.backend, kernel.bNoPrefetch, kernel.iWays);
+
+      uint8_t bWork[sizeof(miner_work::bWorkBlob) * Cryptonight::MAX_WAYS] = {0};
+      uint64_t iCount = 0;
+      auto start = steady_clock::now();
+      while (!bStop.load(std::memory_order_relaxed)) {
+        hash_fun(ctxp, bWork, 76);
+        iCount += kernel.iWays;
+      }
+      vHps[i] = iCount / duration<double>(steady_clock::now() - start).count();
+    });
+
+    if (cfg.iCpuAff >= 0)
+      thd_setaffinity(vThds.back().native_handle(), cfg.iCpuAff);
+    vPinned[i].set_value();
+  }
+
+  std::this_thread::sleep_for(seconds(iSeconds));
+  bStop = true;
+
+  double fTotal = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    vThds[i].join();
+    fTotal += vHps[i];
+  }
+  return fTotal;
+}
+
 void minethd::switch_work(miner_work &pWork) {
-  // iConsumeCnt is a basic lock-like polling mechanism just in case we happen
-  // to push work
-  // faster than threads can consume them. This should never happen in real
-  // life.
-  // Pool cant physically send jobs faster than every 250ms or so due to net
-  // latency.
+  // Only the executor publishes. A thread copies the newest job without a
+  // lock and skips any it never got to, so there is nothing to wait for.
+  uint64_t iJob = oGlobalWork.version() + 1;
+  uint32_t iSpaceBits = nonce_space_bits(pWork);
+  oGlobalWork.publish(pWork, [iJob, iSpaceBits] {
+    iConsumeCnt.store(iJob << 32, std::memory_order_relaxed);
+    oNonces.reset(iJob, iSpaceBits);
+
+    // The flags go up before the job is visible, so a thread that already
+    // has the new job never sees its flag raised afterwards
+    iSwitchTimestamp.store(get_timestamp_us(), std::memory_order_relaxed);
+    for (auto &thd : *pvAllThreads)
+      thd.second->bCancelHash.store(true, std::memory_order_seq_cst);
+  });
+}
+
+void minethd::handoff_stats(uint64_t &iLastUs, uint64_t &iWorstUs) {
+  iLastUs = iHandoffUs.load(std::memory_order_relaxed);
+  iWorstUs = iHandoffWorstUs.load(std::memory_order_relaxed);
+}
+
+uint64_t minethd::stats_snapshot(std::vector<thd_stats> &vStats) {
+  // Only reads, a thread never waits for it and the cache lines of the
+  // threads stay with them until their next write
+  vStats.resize(pvAllThreads->size());
+  for (size_t i = 0; i < vStats.size(); i++)
+    pvAllThreads->at(i)->oStatsCell.read(vStats[i]);
+
+  // Stamped after the reads, so the counts are mostly carried forward from
+  // the last report of each thread
+  uint64_t iStamp = get_timestamp_ms();
+  for (thd_stats &oStats : vStats)
+    oStats.move_to(iStamp);
+  return iStamp;
+}
+
+void minethd::report_hashes(uint64_t iHashCount, bool bIdle) {
+  if (bIdle)
+    oStats.idle(iHashCount, get_timestamp_ms());
+  else
+    oStats.report(iHashCount, get_timestamp_ms());
+  oStatsCell.write(oStats);
+}
 
-  while (iConsumeCnt.load(std::memory_order_seq_cst) < iThreadCount)
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+void minethd::nonce_stats(uint32_t &iHandedOut, uint32_t &iRanges,
+                          uint64_t &iSplits, uint64_t &iSpent) {
+  iHandedOut = oNonces.handed_out();
+  iRanges = oNonces.ranges();
+  iSplits = iRangeSplits.load(std::memory_order_relaxed);
+  iSpent = iSpentJobs.load(std::memory_order_relaxed);
+}
+
+void minethd::wait_for_work() { oGlobalWork.wait_newer(iJobNo); }
 
-  oGlobalWork = pWork;
-  iConsumeCnt.store(0, std::memory_order_seq_cst);
-  iGlobalJobNo++;
+bool minethd::next_nonce(uint32_t &iNonce) {
+  uint32_t iOffset;
+  while (!oRange.next(oNonces, iJobNo, iOffset))
+    if (!split_range())
+      return false;
+  iNonce = iNonceBase | iOffset;
+  return true;
+}
+
+bool minethd::split_range() {
+  // The job has no ranges left, so take half of what the thread furthest
+  // from the end of its range of the same job still has
+  if (oGlobalWork.version() != iJobNo)
+    return false;
+  if (!oRange.split_from(
+          iJobNo, pvAllThreads->begin(), pvAllThreads->end(),
+          [](const std::pair<const int, minethd *> &thd) -> nonce_range & {
+            return thd.second->oRange;
+          }))
+    return false;
+  iRangeSplits.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void minethd::nonces_ran_out() {
+  // Nothing to do when a newer job took the ranges away
+  if (oGlobalWork.version() != iJobNo)
+    return;
+  if (oNonces.first_to_run_out(iJobNo)) {
+    iSpentJobs.fetch_add(1, std::memory_order_relaxed);
+    printer::inst()->print_msg(L0, "WARNING: All nonces of job %s are hashed, "
+                                   "waiting for the pool to send a new one.",
+                               oWork.sJobID);
+  }
+  wait_for_work();
 }
 
 void minethd::consume_work() {
-  memcpy(&oWork, &oGlobalWork, sizeof(miner_work));
-  iJobNo++;
-  iConsumeCnt++;
+  // The flag is cleared on every try, a job published during the copy makes
+  // the copy start over and raises it again
+  iJobNo = oGlobalWork.read(oWork, [this] {
+    bCancelHash.store(false, std::memory_order_seq_cst);
+  });
+
+  // The ranges of the last job are worthless now, the next nonce takes a new one
+  uint32_t iResume = (oWork.iResumeCnt & 0x3) << nonce_space_bits(oWork);
+  iNonceBase = oWork.bNiceHash
+                   ? (get32byte(oWork.bWorkBlob, 39) & 0xFF000000) | iResume
+                   : iResume;
+  oRange.clear(iJobNo);
+
+  // A thread that took an older job does not count for the new one. The last
+  // thread to take the job times the hand-off for all of them.
+  uint64_t iCnt = iConsumeCnt.load(std::memory_order_relaxed);
+  do {
+    if ((iCnt >> 32) != (iJobNo & 0xFFFFFFFF))
+      return;
+  } while (!iConsumeCnt.compare_exchange_weak(iCnt, iCnt + 1,
+                                              std::memory_order_relaxed));
+
+  if (((iCnt + 1) & 0xFFFFFFFF) == iThreadCount) {
+    uint64_t iUs = get_timestamp_us() -
+                   iSwitchTimestamp.load(std::memory_order_relaxed);
+    iHandoffUs.store(iUs, std::memory_order_relaxed);
+    if (iUs > iHandoffWorstUs.load(std::memory_order_relaxed))
+      iHandoffWorstUs.store(iUs, std::memory_order_relaxed);
+  }
 }
 
 void minethd::pin_thd_affinity() {
@@ -284,7 +884,13 @@ void minethd::work_main() {
   if (affinity >= 0) //-1 means no affinity
     pin_thd_affinity();
 
-  auto ctx = make_context();
+  cryptonight::Scratchpad pad;
+  alloc_scratchpads(&pad, 1);
+  auto ctx = make_context(oKernel.backend, pad);
+  cryptonight::Context *ctxp = ctx.get();
+  cn_next_fun hash_next =
+      func_next_selector(oKernel.backend, oKernel.bNoPrefetch);
+  ctx->setCancelFlag(&bCancelHash);
   uint64_t iCount = 0;
   job_result result;
 
@@ -297,42 +903,47 @@ void minethd::work_main() {
           raison d'etre of this software it us sensible to just wait until we
          have something*/
 
-      while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
+      report_hashes(iCount, true);
+      wait_for_work();
       consume_work();
       continue;
     }
 
-    if (oWork.bNiceHash)
-      result.iNonce = calc_nicehash_nonce(get32byte(oWork.bWorkBlob, 39), oWork.iResumeCnt);
-    else
-      result.iNonce = calc_start_nonce(oWork.iResumeCnt);
-
     assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
     memcpy(result.sJobID, oWork.sJobID, sizeof(job_result::sJobID));
 
-    while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo) {
+    static_assert(sizeof(miner_work::bWorkBlob) <=
+                      cryptonight::Cryptonight::MAX_BLOB_SIZE,
+                  "Work blob does not fit the hash context");
+    ctx->setBlob(oWork.bWorkBlob, oWork.iWorkSize);
+
+    while (oGlobalWork.version() == iJobNo) {
       if ((iCount & 0xF) == 0) // Store stats every 16 hashes
-      {
-        using namespace std::chrono;
-        uint64_t iStamp =
-            time_point_cast<milliseconds>(high_resolution_clock::now())
-                .time_since_epoch()
-                .count();
-        iHashCount.store(iCount, std::memory_order_relaxed);
-        iTimestamp.store(iStamp, std::memory_order_relaxed);
-      }
-      iCount++;
+        report_hashes(iCount, false);
 
-      set32byte(oWork.bWorkBlob, 39, ++result.iNonce);
+      if (!next_nonce(result.iNonce)) {
+        report_hashes(iCount, true);
+        nonces_ran_out();
+        break;
+      }
 
-      auto out = ctx->calculateResult(oWork.bWorkBlob, oWork.iWorkSize);
+      // Consecutive nonces let the context explode the next scratchpad early,
+      // only the first nonce of a range misses
+      auto &out = hash_next(ctxp, result.iNonce);
+      if (ctxp->aborted()) {
+        oStats.iAbortCount++;
+        oStatsCell.write(oStats);
+        continue;
+      }
+      if (iCount++ == 0)
+        note_first_hash();
 
       uint64_t *piHashVal = reinterpret_cast<uint64_t *>(out + 24);
       if (swab64(*piHashVal) < oWork.iTarget) {
         memcpy(result.bResult, out, sizeof(result.bResult));
         executor::inst()->push_event(ex_event(result, oWork.iPoolId));
+        oStats.iResultCount++;
+        oStatsCell.write(oStats);
       }
 
       std::this_thread::yield();
@@ -342,17 +953,25 @@ void minethd::work_main() {
   }
 }
 
-void minethd::double_work_main() {
+template <size_t N> void minethd::multiway_work_main() {
   if (affinity >= 0) //-1 means no affinity
     pin_thd_affinity();
 
-  auto ctx0 = make_context();
-  auto ctx1 = make_context();
+  std::unique_ptr<cryptonight::Context> ctx[N];
+  cryptonight::Context *ctxp[N];
+  cryptonight::Scratchpad pads[N];
+  alloc_scratchpads(pads, N);
+  for (size_t i = 0; i < N; i++) {
+    ctx[i] = make_context(oKernel.backend, pads[i]);
+    ctx[i]->setCancelFlag(&bCancelHash);
+    ctxp[i] = ctx[i].get();
+  }
+  cn_hash_fun hash_fun =
+      func_ways_selector(oKernel.backend, oKernel.bNoPrefetch, N);
+
   uint64_t iCount = 0;
-  uint8_t bDoubleHashOut[64];
-  uint8_t bDoubleWorkBlob[sizeof(miner_work::bWorkBlob) * 2];
-  uint32_t iNonce;
-  job_result res;
+  uint8_t bWorkBlob[sizeof(miner_work::bWorkBlob) * N];
+  uint32_t iNonce[N];
 
   iConsumeCnt++;
 
@@ -364,61 +983,59 @@ void minethd::double_work_main() {
       raison d'etre of this software it us sensible to just wait until we have
       something*/
 
-      while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
+      report_hashes(iCount * N, true);
+      wait_for_work();
       consume_work();
-      memcpy(bDoubleWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
-      memcpy(bDoubleWorkBlob + oWork.iWorkSize, oWork.bWorkBlob,
-             oWork.iWorkSize);
+      for (size_t i = 0; i < N; i++)
+        memcpy(bWorkBlob + oWork.iWorkSize * i, oWork.bWorkBlob,
+               oWork.iWorkSize);
       continue;
     }
 
-    if (oWork.bNiceHash)
-      iNonce = calc_nicehash_nonce(get32byte(bDoubleWorkBlob, 39), oWork.iResumeCnt);
-    else
-      iNonce = calc_start_nonce(oWork.iResumeCnt);
-
     assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
 
-    while (iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo) {
-      if ((iCount & 0x7) == 0) // Store stats every 16 hashes
-      {
-        using namespace std::chrono;
-        uint64_t iStamp =
-            time_point_cast<milliseconds>(high_resolution_clock::now())
-                .time_since_epoch()
-                .count();
-        iHashCount.store(iCount, std::memory_order_relaxed);
-        iTimestamp.store(iStamp, std::memory_order_relaxed);
+    while (oGlobalWork.version() == iJobNo) {
+      if ((iCount & 0xF) == 0) // Store stats every 16 rounds
+        report_hashes(iCount * N, false);
+
+      // A round may span two ranges, every hash gets its own nonce
+      size_t i = 0;
+      for (; i < N && next_nonce(iNonce[i]); i++)
+        set32byte(bWorkBlob + oWork.iWorkSize * i, 39, iNonce[i]);
+      if (i < N) {
+        report_hashes(iCount * N, true);
+        nonces_ran_out();
+        break;
       }
 
-      iCount += 2;
-
-      set32byte(bDoubleWorkBlob, 39, ++iNonce);
-      set32byte(bDoubleWorkBlob + oWork.iWorkSize, 39, ++iNonce);
-
-      // TODO: Implement the double or more hashing
-      auto out0 = ctx0->calculateResult(bDoubleWorkBlob, oWork.iWorkSize);
-      auto out1 = ctx1->calculateResult(bDoubleWorkBlob + oWork.iWorkSize,
-                                        oWork.iWorkSize);
-
-      uint64_t *piHashVal0 = reinterpret_cast<uint64_t *>(out0 + 24);
-      if (*piHashVal0 < oWork.iTarget) {
-        executor::inst()->push_event(ex_event(
-            job_result(oWork.sJobID, iNonce - 1, out0), oWork.iPoolId));
+      hash_fun(ctxp, bWorkBlob, oWork.iWorkSize);
+      // The round is dropped whole, its finished hashes are of the old job
+      if (cryptonight::Context::anyAborted<N>(ctxp)) {
+        oStats.iAbortCount += N;
+        oStatsCell.write(oStats);
+        continue;
       }
-      uint64_t *piHashVal1 = reinterpret_cast<uint64_t *>(out1 + 24);
-      if (*piHashVal1 < oWork.iTarget) {
-        executor::inst()->push_event(
-            ex_event(job_result(oWork.sJobID, iNonce, out1), oWork.iPoolId));
+      if (iCount++ == 0)
+        note_first_hash();
+
+      for (size_t i = 0; i < N; i++) {
+        auto &out = ctxp[i]->result();
+        uint64_t *piHashVal = reinterpret_cast<uint64_t *>(out + 24);
+        if (swab64(*piHashVal) < oWork.iTarget) {
+          executor::inst()->push_event(
+              ex_event(job_result(oWork.sJobID, iNonce[i], out),
+                       oWork.iPoolId));
+          oStats.iResultCount++;
+          oStatsCell.write(oStats);
+        }
       }
 
       std::this_thread::yield();
     }
 
     consume_work();
-    memcpy(bDoubleWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
-    memcpy(bDoubleWorkBlob + oWork.iWorkSize, oWork.bWorkBlob, oWork.iWorkSize);
+    for (size_t i = 0; i < N; i++)
+      memcpy(bWorkBlob + oWork.iWorkSize * i, oWork.bWorkBlob,
+             oWork.iWorkSize);
   }
 }
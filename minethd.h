@@ -1,26 +1,20 @@
 #pragma once
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 #include "crypto/cryptonight.hpp"
-
-class telemetry
-{
-public:
-	telemetry(size_t iThd);
-	void push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp);
-	double calc_telemetry_data(size_t iLastMilisec, size_t iThread);
-
-private:
-	constexpr static size_t iBucketSize = 2 << 11; //Power of 2 to simplify calculations
-	constexpr static size_t iBucketMask = iBucketSize - 1;
-	uint32_t* iBucketTop;
-	uint64_t** ppHashCounts;
-	uint64_t** ppTimestamps;
-};
+#include "crypto/kernel_set.hpp"
+#include "seqslot.hpp"
+#include "hash_sample.hpp"
+#include "nonce_dispenser.hpp"
+#include "telemetry.h"
 
 class minethd
 {
 public:
+	// Plain bytes, so seqslot may copy it between the threads
 	struct miner_work
 	{
 		char        sJobID[64];
@@ -39,103 +33,179 @@ public:
 			iTarget(iTarget), bNiceHash(bNiceHash), bStall(false), iPoolId(iPoolId)
 		{
 			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(this->sJobID, sJobID, sizeof(miner_work::sJobID));
+			strncpy(this->sJobID, sJobID, sizeof(miner_work::sJobID));
 			memcpy(this->bWorkBlob, bWork, iWorkSize);
 		}
-
-		miner_work(miner_work const&) = delete;
-
-		miner_work& operator=(miner_work const& from)
-		{
-			assert(this != &from);
-
-			iWorkSize = from.iWorkSize;
-			iResumeCnt = from.iResumeCnt;
-			iTarget = from.iTarget;
-			bNiceHash = from.bNiceHash;
-			bStall = from.bStall;
-			iPoolId = from.iPoolId;
-
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
-
-			return *this;
-		}
-
-		miner_work(miner_work&& from) : iWorkSize(from.iWorkSize), iTarget(from.iTarget),
-			bStall(from.bStall), iPoolId(from.iPoolId)
-		{
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
-		}
-
-		miner_work& operator=(miner_work&& from)
-		{
-			assert(this != &from);
-
-			iWorkSize = from.iWorkSize;
-			iResumeCnt = from.iResumeCnt;
-			iTarget = from.iTarget;
-			bNiceHash = from.bNiceHash;
-			bStall = from.bStall;
-			iPoolId = from.iPoolId;
-
-			assert(iWorkSize <= sizeof(bWorkBlob));
-			memcpy(sJobID, from.sJobID, sizeof(sJobID));
-			memcpy(bWorkBlob, from.bWorkBlob, iWorkSize);
-
-			return *this;
-		}
 	};
 
+	// Publishes a job and wakes the stalled threads, never waits for them to take it
 	static void switch_work(miner_work& pWork);
+	// Microseconds from switch_work until every thread had the job, for the last
+	// job all threads took and the slowest one so far
+	static void handoff_stats(uint64_t& iLastUs, uint64_t& iWorstUs);
+	// The nonce ranges the threads took of the current job and how many it has, how often
+	// a thread split the rest of a slower thread's range and how many jobs ran out of nonces
+	static void nonce_stats(uint32_t& iHandedOut, uint32_t& iRanges, uint64_t& iSplits, uint64_t& iSpentJobs);
 	static std::map<int,minethd*>* thread_starter(miner_work& pWork);
 	static char self_test();
 
-	std::atomic<uint64_t> iHashCount;
-	std::atomic<uint64_t> iTimestamp;
-
-private:
-	typedef void (*cn_hash_fun)(const void*, size_t, void*, cryptonight::Cryptonight*);
-	typedef void (*cn_hash_fun_dbl)(const void*, size_t, void*, cryptonight::Cryptonight* __restrict, cryptonight::Cryptonight* __restrict);
-
-	minethd(miner_work& pWork, size_t iNo, char double_work, char no_prefetch, int64_t affinity);
+	// The hash backend the threads run, picked from the CPU features and aes_override
+	enum cn_backend { cn_generic, cn_ssse3, cn_hw_aes, cn_vaes };
+	static cn_backend backend_selector();
+	// The kernels the threads hash with, the build for the highest x86-64 level the CPU has
+	static const cryptonight::KernelSet& kernel_set_selector();
+	// The AES backend and the build of the hash kernels, for the banner and the API
+	static std::string aes_backend_name();
+	static std::string kernel_set_name();
+
+	// What a thread hashes with: the AES backend, how many hashes it runs in lockstep
+	// and whether the main loop prefetches
+	struct kernel_variant
+	{
+		cn_backend backend;
+		size_t iWays;
+		bool bNoPrefetch;
+	};
+	// The kernels of all configured threads, as the thread config says or, with autotune, the fastest
+	// ones measured on the cores of the threads. The measurement is cached per host, bRetune redoes it.
+	static const std::vector<kernel_variant>& select_kernels(bool bRetune);
+	static std::string kernel_name(const kernel_variant& kernel);
+
+	// Where a thread gets its scratchpads: the slab holding them, shared by all threads of a NUMA
+	// node, and the first one of it for the thread, or no slab for a thread that maps its own.
+	// iColour bytes separate two of them.
+	struct pad_plan
+	{
+		std::shared_ptr<cryptonight::ScratchpadArena> pSlab;
+		size_t iFirst;
+		int iNode;
+		size_t iColour;
+	};
 
-	// We use the top 10 bits of the nonce for thread and resume
-	// This allows us to resume up to 128 threads 4 times before
-	// we get nonce collisions
-	// Bottom 22 bits allow for an hour of work at 1000 H/s
-	inline uint32_t calc_start_nonce(uint32_t resume)
-		{ return (resume * iThreadCount + iThreadNo) << 22; }
+	// Hashes on all configured threads for iSeconds with the scratchpads iColour bytes apart,
+	// returns the total H/s. The miner threads must not be running.
+	static double layout_benchmark(size_t iColour, size_t iSeconds);
 
-	// Limited version of the nonce calc above
-	inline uint32_t calc_nicehash_nonce(uint32_t start, uint32_t resume)
-		{ return start | (resume * iThreadCount + iThreadNo) << 18; }
+	// What a thread reports about itself: the hashes it did by iTimestamp (in ms), the
+	// hashes it gave up half way because a new job came in, the results it found and
+	// its kernel. Only the thread writes them, every 16 rounds, before it waits and on
+	// every abort or result, the count and the timestamp always come from the same write.
+	struct thd_stats : hash_sample
+	{
+		uint64_t iAbortCount;
+		uint64_t iResultCount;
+		kernel_variant oKernel;
+	};
+	// Copies the stats of all threads in thread order without a lock and brings their
+	// hash counts to one instant, the time (in ms) it returns. Every iTimestamp holds
+	// it, but 0 for a thread that has not reported yet.
+	static uint64_t stats_snapshot(std::vector<thd_stats>& vStats);
+
+	// Where the scratchpads ended up: the page size asked for (0 for slow memory),
+	// how many there are and how many of them are entirely on huge pages
+	std::atomic<uint32_t> iPadPageKb;
+	std::atomic<uint32_t> iPadCount;
+	std::atomic<uint32_t> iHugePadCount;
+	std::atomic<bool> bPadLocked;
+	// The NUMA node the thread is pinned to (-1 if none) and the scratchpad pages move_pages finds elsewhere
+	int iNumaNode;
+	std::atomic<uint64_t> iRemotePages;
+	// The kernel the thread runs
+	kernel_variant oKernel;
 
-	static cn_hash_fun func_selector(char bHaveAes, char bNoPrefetch);
-	static cn_hash_fun_dbl func_dbl_selector(char bHaveAes, char bNoPrefetch);
+private:
+	// The stats as the thread has them and as others read them
+	thd_stats oStats;
+	seqcell<thd_stats> oStatsCell;
+	// Stamps the hash count into the stats, bIdle before the thread waits for work
+	void report_hashes(uint64_t iHashCount, bool bIdle);
+
+	// Hashes N inputs of len bytes laid out back to back, one context each
+	typedef cryptonight::KernelSet::HashFun cn_hash_fun;
+	// Hashes the blob set on ctx with the given nonce
+	typedef cryptonight::KernelSet::NextFun cn_next_fun;
+
+	minethd(miner_work& pWork, size_t iNo, const kernel_variant& kernel, int64_t affinity,
+		const pad_plan& pads);
+
+	// Picks the kernel of the kernel set once per thread
+	static cn_hash_fun func_selector(cn_backend backend, bool bNoPrefetch)
+		{ return func_ways_selector(backend, bNoPrefetch, 1); }
+	static cn_hash_fun func_ways_selector(cn_backend backend, bool bNoPrefetch, size_t iWays);
+	static cn_next_fun func_next_selector(cn_backend backend, bool bNoPrefetch);
+
+	// Hashes with the kernel on the scratchpads for iMs milliseconds, returns the H/s
+	static double measure_kernel(const kernel_variant& kernel, cryptonight::Scratchpad* pads, size_t iMs);
+	// Measures the kernels on all threads at once, each on its own core, and keeps the fastest per thread
+	static std::vector<kernel_variant> tune_kernels(std::vector<double>& vHps);
+	static std::vector<kernel_variant> vKernels;
+
+	// Takes the scratchpads of the thread from its slab, or maps them as use_slow_memory
+	// says, and reports where they ended up
+	void alloc_scratchpads(cryptonight::Scratchpad* pads, size_t n);
+
+	// Maps, locks and faults in the scratchpads of every configured thread, all slabs in parallel,
+	// and tells each thread where its scratchpads are
+	static std::vector<pad_plan> plan_scratchpads(size_t iColour);
+	pad_plan oPads;
 
 	void work_main();
-	void double_work_main();
+	template<size_t N>
+	void multiway_work_main();
+	// Sleeps until switch_work publishes a job newer than the one the thread has
+	void wait_for_work();
 	void consume_work();
 
-	static std::atomic<uint64_t> iGlobalJobNo;
+	// The threads share the nonces of a job through oNonces. The top 2 bits (below the
+	// byte NiceHash reserves) are the resume count of the job, so a job taken again
+	// after a reconnect gets fresh nonces 4 times, the rest is handed out in ranges.
+	static nonce_dispenser oNonces;
+	static uint32_t nonce_space_bits(const miner_work& oWork)
+		{ return oWork.bNiceHash ? 22 : 30; }
+	// The next nonce of the range the thread holds, of a new range or of the second half
+	// of what a slower thread has left. False once all of them are gone or a newer job
+	// came in.
+	bool next_nonce(uint32_t& iNonce);
+	bool split_range();
+	// Waits out a job that has no nonces left instead of hashing any twice
+	void nonces_ran_out();
+	uint32_t iNonceBase;
+	// The nonces of its range the thread has not hashed yet, other threads shorten it
+	// in split_range
+	nonce_range oRange;
+	static std::atomic<uint64_t> iRangeSplits;
+	static std::atomic<uint64_t> iSpentJobs;
+
+	// The job number in the top half and in the bottom half the threads that took that
+	// job, or before the first job the threads that are set up
 	static std::atomic<uint64_t> iConsumeCnt;
 	static uint64_t iThreadCount;
 	uint64_t iJobNo;
 
-	static miner_work oGlobalWork;
+	// All threads, so switch_work can raise their cancel flags
+	static std::map<int,minethd*>* pvAllThreads;
+	// When switch_work last published a job, in microseconds
+	static std::atomic<uint64_t> iSwitchTimestamp;
+	static std::atomic<uint64_t> iHandoffUs;
+	static std::atomic<uint64_t> iHandoffWorstUs;
+	// When thread_starter began, in microseconds, and whether a thread has finished a hash since
+	static uint64_t iStartTimestamp;
+	static std::atomic<bool> bFirstHash;
+	// Logs the time to the first hash, once for all threads
+	static void note_first_hash();
+	// Raised by switch_work, aborts the hash in flight
+	std::atomic<bool> bCancelHash;
+
+	// The newest job, its version is the job number
+	static seqslot<miner_work> oGlobalWork;
 	miner_work oWork;
 
 	void pin_thd_affinity();
 
 	std::thread oWorkThd;
-	uint8_t iThreadNo;
+	size_t iThreadNo;
 	int64_t affinity;
 
 	char bQuit;
-	char bNoPrefetch;
 };
 
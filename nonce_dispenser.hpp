@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// Hands out the nonces of a job in small contiguous ranges from one atomic cursor,
+// so any number of threads share the nonce space and a faster thread simply takes
+// more ranges. The cursor carries the job number in its top half, a thread asking
+// with an older job gets nothing and a range is never handed out twice in a job.
+class nonce_dispenser
+{
+public:
+	// 1024 nonces, a few seconds of hashing for one thread
+	constexpr static uint32_t iRangeBits = 10;
+	constexpr static uint32_t iRangeSize = 1u << iRangeBits;
+
+	nonce_dispenser() : cursor_(0), ranges_(0), exhausted_(0) { }
+
+	// Starts job iJob with 2^iSpaceBits nonces. Only the publisher of the job calls
+	// this, before any thread can ask for a range of it.
+	void reset(uint64_t iJob, uint32_t iSpaceBits)
+	{
+		ranges_.store(iSpaceBits > iRangeBits ? 1u << (iSpaceBits - iRangeBits) : 1u, std::memory_order_relaxed);
+		cursor_.store(iJob << 32, std::memory_order_release);
+	}
+
+	// Takes the next range of the job, as the offset of its first nonce in the nonce
+	// space. False if the job is not the current one or all of its ranges are gone.
+	bool next(uint64_t iJob, uint32_t& iOffset)
+	{
+		uint64_t cur = cursor_.load(std::memory_order_acquire);
+		do
+		{
+			if ((cur >> 32) != (iJob & 0xFFFFFFFF) || uint32_t(cur) >= ranges_.load(std::memory_order_relaxed))
+				return false;
+		}
+		while (!cursor_.compare_exchange_weak(cur, cur + 1, std::memory_order_acq_rel));
+
+		iOffset = uint32_t(cur) << iRangeBits;
+		return true;
+	}
+
+	// True for exactly one caller once job iJob has run out of ranges. False for a job
+	// that is not the current one, a thread may still ask for the old job while the
+	// next one is being published.
+	bool first_to_run_out(uint64_t iJob)
+	{
+		uint64_t iMark = (iJob & 0xFFFFFFFF) + 1;
+		if ((cursor_.load(std::memory_order_acquire) >> 32) != (iJob & 0xFFFFFFFF))
+			return false;
+		return exhausted_.exchange(iMark, std::memory_order_relaxed) != iMark;
+	}
+
+	// The ranges handed out for the current job so far and the ranges it has
+	uint32_t handed_out() const { return uint32_t(cursor_.load(std::memory_order_relaxed)); }
+	uint32_t ranges() const { return ranges_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> cursor_;
+	std::atomic<uint32_t> ranges_;
+	// One more than the last job that ran out, 0 before any did
+	std::atomic<uint64_t> exhausted_;
+};
+
+// The rest of the range one thread is hashing. The next and the end offset share one
+// atomic word with the low bits of the job number, so other threads can split the range
+// with a CAS and never take the range of another job for one of theirs. Only a range
+// four jobs older could pass, and its owner would have to take all of those jobs between
+// the load and the CAS of one split.
+class nonce_range
+{
+public:
+	nonce_range() : word_(0) { }
+
+	// Drops what is left, the next offset of job iJob comes from a new range
+	void clear(uint64_t iJob)
+	{
+		word_.store(pack(iJob, 0, 0), std::memory_order_release);
+	}
+
+	// The next offset of job iJob, from this range or from a new one of the dispenser.
+	// False once the dispenser has no ranges left, split_from may still find some.
+	bool next(nonce_dispenser& nonces, uint64_t iJob, uint32_t& iOffset)
+	{
+		// A CAS and not an increment, split_from may have moved the end meanwhile
+		uint64_t cur = word_.load(std::memory_order_acquire);
+		while (true)
+		{
+			if (job_of(cur) != job_bits(iJob) || next_of(cur) == end_of(cur))
+			{
+				uint32_t iBegin;
+				if (!nonces.next(iJob, iBegin))
+					return false;
+				word_.store(pack(iJob, iBegin, iBegin + nonce_dispenser::iRangeSize), std::memory_order_release);
+				cur = word_.load(std::memory_order_acquire);
+				continue;
+			}
+
+			if (word_.compare_exchange_weak(cur, cur + 1, std::memory_order_acq_rel))
+			{
+				iOffset = next_of(cur);
+				return true;
+			}
+		}
+	}
+
+	// Takes the second half of what the fullest range of job iJob still has, once the
+	// dispenser has none left. Nobody touches an empty range, so the store into this one
+	// cannot undo a split of it. get(*it) gives the range of a thread. False if no range
+	// of the job has two offsets left.
+	template <typename It, typename Get>
+	bool split_from(uint64_t iJob, It first, It last, Get get)
+	{
+		while (true)
+		{
+			nonce_range* victim = nullptr;
+			uint64_t seen = 0;
+			uint32_t most = 1;
+			for (It it = first; it != last; ++it)
+			{
+				nonce_range& range = get(*it);
+				uint64_t cur = range.word_.load(std::memory_order_acquire);
+				uint32_t left = end_of(cur) - next_of(cur);
+				if (&range != this && job_of(cur) == job_bits(iJob) && left > most)
+				{
+					victim = &range;
+					seen = cur;
+					most = left;
+				}
+			}
+			if (victim == nullptr)
+				return false;
+
+			uint32_t end = end_of(seen);
+			uint32_t mid = end - most / 2;
+			if (victim->word_.compare_exchange_strong(seen, pack(iJob, next_of(seen), mid), std::memory_order_acq_rel))
+			{
+				word_.store(pack(iJob, mid, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+
+private:
+	// An offset or the end of a nonce space of up to 2^30 nonces
+	constexpr static uint32_t iOffsetBits = 31;
+	constexpr static uint64_t iOffsetMask = (uint64_t(1) << iOffsetBits) - 1;
+
+	static uint64_t job_bits(uint64_t iJob) { return iJob & 3; }
+	static uint64_t job_of(uint64_t word) { return word >> (2 * iOffsetBits); }
+	static uint32_t next_of(uint64_t word) { return uint32_t(word & iOffsetMask); }
+	static uint32_t end_of(uint64_t word) { return uint32_t((word >> iOffsetBits) & iOffsetMask); }
+	static uint64_t pack(uint64_t iJob, uint32_t next, uint32_t end)
+	{
+		return job_bits(iJob) << (2 * iOffsetBits) | uint64_t(end) << iOffsetBits | next;
+	}
+
+	std::atomic<uint64_t> word_;
+};
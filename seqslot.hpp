@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <type_traits>
+
+// One value published by a single writer and read by any number of threads without
+// a lock. Readers copy the newest value and try again if the writer changed it in
+// the middle of the copy, the writer never waits for them. T is copied byte for byte,
+// so it must be trivially copyable.
+template <typename T>
+class seqslot
+{
+	static_assert(std::is_trivially_copyable<T>::value, "seqslot copies T with memcpy");
+
+public:
+	seqslot() : seq_(0) { }
+
+	// Publishes a value and returns its version. before_visible runs while readers
+	// still get the previous one.
+	template <typename F>
+	uint64_t publish(const T& item, F before_visible)
+	{
+		uint64_t seq = seq_.load(std::memory_order_relaxed);
+		seq_.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&item_, &item, sizeof(T));
+		before_visible();
+		seq_.store(seq + 2, std::memory_order_release);
+
+		// A waiter holds the lock from checking the version until it sleeps, so
+		// taking it here means none of them misses the notification
+		{ std::lock_guard<std::mutex> mlock(mutex_); }
+		cond_.notify_all();
+		return (seq + 2) / 2;
+	}
+
+	// The version of the newest value, 0 before the first publish
+	uint64_t version() const
+	{
+		return seq_.load(std::memory_order_acquire) / 2;
+	}
+
+	// Copies the newest value and returns its version. on_attempt runs before every
+	// try, anything it clears is raised again by a publish during the copy.
+	template <typename F>
+	uint64_t read(T& item, F on_attempt) const
+	{
+		while (true)
+		{
+			uint64_t seq = seq_.load(std::memory_order_acquire);
+			if ((seq & 1) != 0)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			on_attempt();
+			memcpy(&item, &item_, sizeof(T));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq_.load(std::memory_order_seq_cst) == seq)
+				return seq / 2;
+		}
+	}
+
+	// Sleeps until a version newer than ver is published
+	void wait_newer(uint64_t ver)
+	{
+		std::unique_lock<std::mutex> mlock(mutex_);
+		while (version() == ver) { cond_.wait(mlock); }
+	}
+
+private:
+	std::atomic<uint64_t> seq_;
+	T item_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+};
+
+// A value one thread writes often and others copy now and then, without a lock and
+// like seqslot, but without waiters. The padding keeps the value on cache lines of
+// its own, so neighbouring objects never take them away from the writer.
+template <typename T>
+class seqcell
+{
+	static_assert(std::is_trivially_copyable<T>::value, "seqcell copies T with memcpy");
+
+public:
+	seqcell() : seq_(0), item_() { }
+
+	void write(const T& item)
+	{
+		uint64_t seq = seq_.load(std::memory_order_relaxed);
+		seq_.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&item_, &item, sizeof(T));
+		seq_.store(seq + 2, std::memory_order_release);
+	}
+
+	// Copies the value of one write, never half of two
+	void read(T& item) const
+	{
+		while (true)
+		{
+			uint64_t seq = seq_.load(std::memory_order_acquire);
+			if ((seq & 1) != 0)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			memcpy(&item, &item_, sizeof(T));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq_.load(std::memory_order_seq_cst) == seq)
+				return;
+		}
+	}
+
+private:
+	// A cache line on either side, the allocation need not be aligned to one
+	char before_[64];
+	std::atomic<uint64_t> seq_;
+	T item_;
+	char after_[64];
+};
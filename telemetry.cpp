@@ -0,0 +1,137 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting
+ * work.
+  *
+  */
+
+#include "telemetry.h"
+
+#include <chrono>
+#include <cmath>
+
+const uint64_t telemetry::iBucketMs[telemetry::iLevelCount] = {1000, 15000,
+                                                                60000};
+const size_t telemetry::iEwmaWindows[telemetry::iEwmaCount] = {2500, 60000,
+                                                               900000};
+
+telemetry::telemetry(size_t iThd) {
+  thd_series oEmpty = {{0, 0}, {0, 0}, {}};
+  for (size_t k = 0; k < iEwmaCount; k++)
+    oEmpty.fEwma[k] = nan("");
+  vThds.assign(iThd, oEmpty);
+  vBuckets.assign(iThd * iLevelCount * iBucketCount, {~uint64_t(0), {0, 0}});
+}
+
+double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread) {
+  using namespace std::chrono;
+  uint64_t iTimeNow =
+      time_point_cast<milliseconds>(high_resolution_clock::now())
+          .time_since_epoch()
+          .count();
+  return calc_telemetry_data(iLastMilisec, iThread, iTimeNow);
+}
+
+double telemetry::calc_telemetry_data(size_t iLastMilisec, size_t iThread,
+                                      uint64_t iTimeNow) {
+  const thd_series &thd = vThds[iThread];
+
+  // A sample from before the window and one inside it, or we don't have the
+  // data yet
+  if (thd.oFirst.iTimestamp == 0 ||
+      iTimeNow - thd.oFirst.iTimestamp <= iLastMilisec ||
+      iTimeNow - thd.oLast.iTimestamp > iLastMilisec)
+    return nan("");
+
+  // The finest level whose buckets still reach back to the start
+  size_t iLevel = 0;
+  while (iLevel + 1 < iLevelCount &&
+         (iBucketCount - 1) * iBucketMs[iLevel] <= iLastMilisec)
+    iLevel++;
+
+  // The earliest sample inside the window is the first one of the bucket the
+  // window starts in, unless that one is from before the start, or else the
+  // first one of the next bucket that has any. The newest sample ends the
+  // search, so a thread that reports less than once a bucket costs a few steps
+  // and never more than the ring.
+  uint64_t iStart = iTimeNow - iLastMilisec;
+  uint64_t iBucket = iStart / iBucketMs[iLevel];
+  uint64_t iLastBucket = thd.oLast.iTimestamp / iBucketMs[iLevel];
+  const sample *pEarliest = &thd.oLast;
+  const bucket &oStart = at(iThread, iLevel, iBucket);
+  if (oStart.iBucket == iBucket && oStart.oFirst.iTimestamp >= iStart)
+    pEarliest = &oStart.oFirst;
+  else
+    for (iBucket++; iBucket <= iLastBucket; iBucket++) {
+      const bucket &b = at(iThread, iLevel, iBucket);
+      if (b.iBucket == iBucket) {
+        pEarliest = &b.oFirst;
+        break;
+      }
+    }
+
+  if (thd.oLast.iTimestamp == pEarliest->iTimestamp)
+    return nan("");
+
+  double fHashes, fTime;
+  fHashes = thd.oLast.iHashCount - pEarliest->iHashCount;
+  fTime = thd.oLast.iTimestamp - pEarliest->iTimestamp;
+  fTime /= 1000.0;
+
+  return fHashes / fTime;
+}
+
+double telemetry::calc_ewma_data(size_t iWindow, size_t iThread) {
+  return vThds[iThread].fEwma[iWindow];
+}
+
+void telemetry::push_perf_value(size_t iThd, uint64_t iHashCount,
+                                uint64_t iTimestamp) {
+  thd_series &thd = vThds[iThd];
+
+  // The ticks come faster than the threads report, most samples are repeats
+  if (iTimestamp == 0 || iTimestamp <= thd.oLast.iTimestamp)
+    return;
+
+  sample oNew = {iHashCount, iTimestamp};
+  if (thd.oFirst.iTimestamp == 0) {
+    thd.oFirst = oNew;
+  } else {
+    double fTime = double(iTimestamp - thd.oLast.iTimestamp);
+    double fHps = (iHashCount - thd.oLast.iHashCount) * 1000.0 / fTime;
+    for (size_t k = 0; k < iEwmaCount; k++) {
+      if (std::isnan(thd.fEwma[k]))
+        thd.fEwma[k] = fHps;
+      else
+        thd.fEwma[k] += (1.0 - exp(-fTime / iEwmaWindows[k])) *
+                        (fHps - thd.fEwma[k]);
+    }
+  }
+  thd.oLast = oNew;
+
+  for (size_t i = 0; i < iLevelCount; i++) {
+    uint64_t iBucket = iTimestamp / iBucketMs[i];
+    bucket &b = at(iThd, i, iBucket);
+    if (b.iBucket != iBucket) {
+      b.iBucket = iBucket;
+      b.oFirst = oNew;
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// The hash counts of the threads over time, only the executor thread uses it. Every
+// query takes constant time: the samples are kept per second, per 15 seconds and per
+// minute, and a window of any length finds its start in the finest of them that
+// reaches back far enough.
+class telemetry
+{
+public:
+	telemetry(size_t iThd);
+	void push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp);
+	// The H/s of the thread over the last iLastMilisec, NaN until it has been hashing that long
+	double calc_telemetry_data(size_t iLastMilisec, size_t iThread);
+	// The same at the time iTimeNow, in ms like the timestamps of the samples
+	double calc_telemetry_data(size_t iLastMilisec, size_t iThread, uint64_t iTimeNow);
+	// The H/s of the thread averaged exponentially with a time constant of iEwmaWindows[iWindow]
+	// milliseconds, NaN before it reported twice
+	double calc_ewma_data(size_t iWindow, size_t iThread);
+
+	constexpr static size_t iEwmaCount = 3;
+	static const size_t iEwmaWindows[iEwmaCount];
+
+private:
+	struct sample
+	{
+		uint64_t iHashCount;
+		uint64_t iTimestamp;
+	};
+	// The first sample that fell into a bucket, or bucket ~0 if none did yet
+	struct bucket
+	{
+		uint64_t iBucket;
+		sample oFirst;
+	};
+
+	constexpr static size_t iLevelCount = 3;
+	constexpr static size_t iBucketCount = 128;
+	static const uint64_t iBucketMs[iLevelCount];
+
+	bucket& at(size_t iThd, size_t iLevel, uint64_t iBucket)
+		{ return vBuckets[(iThd * iLevelCount + iLevel) * iBucketCount + iBucket % iBucketCount]; }
+
+	struct thd_series
+	{
+		sample oFirst;
+		sample oLast;
+		double fEwma[iEwmaCount];
+	};
+	std::vector<thd_series> vThds;
+	std::vector<bucket> vBuckets;
+};
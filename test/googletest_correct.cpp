@@ -4,14 +4,34 @@
 
 #ifdef __x86_64
 #include "cryptonight_aesni.hpp"
+#include "cryptonight_ssse3.hpp"
 #elif __PPC64__
 #include "cryptonight_altivec.hpp"
 #elif __sparcv9
 #include "cryptonight_sparc.hpp"
 #endif
 
+#include "groestl.h"
+extern "C" {
+#include "blake256.h"
+#include "jh.h"
+#include "skein.h"
+}
 #include "keccak.h"
+#include "kernel_set.hpp"
 #include "portability.hpp"
+#include "../seqslot.hpp"
+#include "../nonce_dispenser.hpp"
+#include "../hash_sample.hpp"
+#include "../topology.h"
+#include "../autotune.h"
+#include "../telemetry.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
 
 using byte = uint8_t;
 
@@ -34,10 +54,17 @@ template <typename T> class HashCorrect : public ::testing::Test
 {
 public:
   T ctx;
+
+protected:
+  void SetUp() override
+  {
+    if (!T::detect())
+      GTEST_SKIP() << "not supported by this CPU";
+  }
 };
 
 #ifdef __x86_64
-typedef testing::Types<Cryptonight, CryptonightAESNI> Implementations;
+typedef testing::Types<Cryptonight, CryptonightAESNI, CryptonightVAES, CryptonightSSSE3> Implementations;
 #elif __PPC__
 typedef testing::Types<Cryptonight, CryptonightAltivec> Implementations;
 #elif __sparcv9
@@ -83,6 +110,182 @@ TEST(CCorrect, Keccak)
   EXPECT_EQ(st2[0], 0x4c434cfaC9a5b256ull);
 }
 
+TEST(CCorrect, KeccakUnrolled)
+{
+  // The unrolled permutation against the plain loop version
+  for (int rounds : {1, 2, 24})
+  {
+    uint64_t st[25], ref[25];
+    for (size_t i = 0; i < 25; ++i)
+      st[i] = ref[i] = 0x9e3779b97f4a7c15ull * (i + 1);
+    keccakf(st, rounds);
+    keccakf_ref(ref, rounds);
+    EXPECT_EQ_A(st, ref, sizeof(st));
+  }
+
+  // The one block absorb against the generic sponge, up to the rate edge
+  uint8_t in[200], md[200], ref[200];
+  for (size_t i = 0; i < sizeof(in); ++i)
+    in[i] = uint8_t(i * 7 + 3);
+  for (size_t len : {0, 1, 8, 43, 76, 112, 135, 136, 200})
+  {
+    keccak1600(in, len, md);
+    keccak(in, len, ref, 200);
+    EXPECT_EQ_A(md, ref, sizeof(md));
+  }
+}
+
+TEST(CCorrect, KeccakX4)
+{
+  // The CCorrect.Keccak vectors in every lane, next to states that differ
+  uint64_t st1[4][25] = {{0x0102030405060708}, {0x0102030405060708}, {1, 2, 3}, {0, 0, 0, 0, 5}};
+  keccakf_x4(st1, 1);
+  EXPECT_EQ(st1[0][0], 0x102030405060709ull);
+  EXPECT_EQ(st1[1][0], 0x102030405060709ull);
+
+  uint64_t st[4][25] = {{0x0102030405060708}, {0x0102030405060708}, {1, 2, 3}, {0, 0, 0, 0, 5}};
+  uint64_t ref[4][25];
+  memcpy(ref, st, sizeof(st));
+  keccakf_x4(st, 2);
+  EXPECT_EQ(st[0][0], 0x4c434cfaC9a5b256ull);
+  EXPECT_EQ(st[1][0], 0x4c434cfaC9a5b256ull);
+  for (size_t n = 0; n < 4; ++n)
+  {
+    keccakf(ref[n], 2);
+    EXPECT_EQ_A(st[n], ref[n], sizeof(ref[n]));
+  }
+
+#ifdef __x86_64
+  if (__builtin_cpu_supports("avx2"))
+  {
+    uint64_t st2[4][25] = {{0x0102030405060708}, {1}, {2}, {3}};
+    memcpy(ref, st2, sizeof(st2));
+    keccakf_x4_avx2(st2, 24);
+    for (size_t n = 0; n < 4; ++n)
+    {
+      keccakf(ref[n], 24);
+      EXPECT_EQ_A(st2[n], ref[n], sizeof(ref[n]));
+    }
+  }
+#endif
+
+  // Inputs spanning two blocks go through the multi-block absorb
+  for (size_t len : {14, 76, 200})
+  {
+    uint8_t in[4][200], md[4][200], single[200];
+    for (size_t i = 0; i < sizeof(in); ++i)
+      in[i / 200][i % 200] = uint8_t(i * 31 + 1);
+    const uint8_t *ins[4] = {in[0], in[1], in[2], in[3]};
+    uint8_t *mds[4]       = {md[0], md[1], md[2], md[3]};
+    keccak1600_x4(ins, len, mds);
+    for (size_t n = 0; n < 4; ++n)
+    {
+      keccak1600(in[n], len, single);
+      EXPECT_EQ_A(md[n], single, 200);
+    }
+  }
+}
+
+#ifdef __x86_64
+TEST(CCorrect, GroestlAESNI)
+{
+  if (!__builtin_cpu_supports("aes"))
+    GTEST_SKIP() << "not supported by this CPU";
+
+  // Around the padding edges: one block, two padding blocks, the finalizer size
+  uint8_t in[200], md[32], ref[32];
+  for (size_t i = 0; i < sizeof(in); ++i)
+    in[i] = uint8_t(i * 13 + 5);
+  for (size_t len : {0, 14, 55, 56, 64, 119, 120, 200})
+  {
+    groestl_aesni(in, len * 8, md);
+    groestl(in, len * 8, ref);
+    EXPECT_EQ_A(md, ref, sizeof(md));
+  }
+}
+#endif
+
+TEST(CCorrect, BlakeX4)
+{
+  // Around the padding edges: one block, two padding blocks, the finalizer size
+  uint8_t in[4][200], md[4][32], ref[32];
+  for (size_t n = 0; n < 4; ++n)
+    for (size_t i = 0; i < sizeof(in[n]); ++i)
+      in[n][i] = uint8_t(i * 7 + n * 31 + 1);
+  const uint8_t *ins[4] = {in[0], in[1], in[2], in[3]};
+  uint8_t *outs[4]      = {md[0], md[1], md[2], md[3]};
+  for (size_t len : {0, 1, 55, 56, 63, 64, 200})
+  {
+    blake256_hash_x4(outs, ins, len);
+    for (size_t n = 0; n < 4; ++n)
+    {
+      blake256_hash(ref, in[n], len);
+      EXPECT_EQ_A(md[n], ref, sizeof(ref));
+    }
+  }
+}
+
+#ifdef __x86_64
+TEST(CCorrect, SkeinX4)
+{
+  if (!__builtin_cpu_supports("avx2"))
+    return;
+
+  uint8_t in[4][200], md[4][32], ref[32];
+  for (size_t n = 0; n < 4; ++n)
+    for (size_t i = 0; i < sizeof(in[n]); ++i)
+      in[n][i] = uint8_t(i * 11 + n * 29 + 3);
+  const uint8_t *ins[4] = {in[0], in[1], in[2], in[3]};
+  uint8_t *outs[4]      = {md[0], md[1], md[2], md[3]};
+  for (size_t len : {0, 1, 64, 65, 128, 200})
+  {
+    skein512_256_x4_avx2(ins, len, outs);
+    for (size_t n = 0; n < 4; ++n)
+    {
+      skein_hash(256, in[n], len * 8, ref);
+      EXPECT_EQ_A(md[n], ref, sizeof(ref));
+    }
+  }
+}
+#endif
+
+TEST(CCorrect, FinalizeResults)
+{
+  // More states than one batch, with runs of every length of each type
+  static const size_t COUNT = 12;
+  const uint8_t types[COUNT] = {0, 3, 0, 3, 1, 0, 3, 2, 0, 0, 3, 0};
+  uint8_t states[COUNT][200], md[COUNT][32], ref[32];
+  const uint8_t *ins[COUNT];
+  uint8_t *outs[COUNT];
+  for (size_t n = 0; n < COUNT; ++n)
+  {
+    for (size_t i = 0; i < sizeof(states[n]); ++i)
+      states[n][i] = uint8_t(i * 5 + n * 17 + 9);
+    states[n][0] = uint8_t((states[n][0] & ~3) | types[n]);
+    ins[n]       = states[n];
+    outs[n]      = md[n];
+  }
+  Cryptonight::finalizeResults(ins, outs, COUNT);
+  for (size_t n = 0; n < COUNT; ++n)
+  {
+    Cryptonight::finalizeResult(states[n], ref);
+    EXPECT_EQ_A(md[n], ref, sizeof(ref));
+  }
+
+#ifdef __x86_64
+  // The same results with Groestl on hardware AES
+  if (__builtin_cpu_supports("aes"))
+  {
+    Cryptonight::finalizeResults(ins, outs, COUNT, true);
+    for (size_t n = 0; n < COUNT; ++n)
+    {
+      Cryptonight::finalizeResult(states[n], ref);
+      EXPECT_EQ_A(md[n], ref, sizeof(ref));
+    }
+  }
+#endif
+}
+
 TYPED_TEST(HashCorrect, Mul128)
 {
   auto &ctx = this->ctx;
@@ -285,6 +488,28 @@ TYPED_TEST(HashCorrect, Keys4Correct)
   EXPECT_EQ_A(ctx.roundKey(3), key3, 16);
 }
 
+TYPED_TEST(HashCorrect, KeyScheduleCorrect)
+{
+  // The ten round keys a hash uses, of both halves, against the table based schedule
+  auto &ctx = this->ctx;
+  Cryptonight ref;
+  uint8_t in[76];
+  for (size_t n = 0; n < 8; n++)
+  {
+    for (size_t i = 0; i < sizeof(in); i++)
+      in[i] = uint8_t(n * 131 + i * 7);
+    ctx.initKeccak(in, sizeof(in));
+    ref.initKeccak(in, sizeof(in));
+    for (size_t offset = 0; offset <= 32; offset += 32)
+    {
+      ctx.initRoundKeys(offset);
+      ref.initRoundKeys(offset);
+      for (size_t k = 0; k < 5; k++)
+        EXPECT_EQ_A(ctx.roundKey(k), ref.roundKey(k), 32);
+    }
+  }
+}
+
 TYPED_TEST(HashCorrect, EncryptedKeccakCorrect)
 {
   auto &ctx = this->ctx;
@@ -351,6 +576,18 @@ TYPED_TEST(HashCorrect, VectorJH)
   EXPECT_EQ_A(ctx.calculateResult(BS("This is another test"), 20),
               "\x18\x91\x05\x42\x8a\x6b\x09\x23\xe4\xfa\x41\x7e\x88\x36\x63\x4c", 16);
   EXPECT_EQ(ctx.hashType(), Cryptonight::JH);
+
+#ifdef __SSE2__
+  // The SSE2 permutation against the portable one on the same state,
+  // with both the one and the two block padding
+  for (size_t len : {0, 20, 64, 200})
+  {
+    uint8_t md[32], ref[32];
+    jh_hash_sse2(32 * 8, ctx.m_keccak, len * 8, md);
+    jh_hash(32 * 8, ctx.m_keccak, len * 8, ref);
+    EXPECT_EQ_A(md, ref, sizeof(md));
+  }
+#endif
 }
 
 TYPED_TEST(HashCorrect, VectorSkein)
@@ -360,4 +597,625 @@ TYPED_TEST(HashCorrect, VectorSkein)
               "\x48\x47\xcd\x48\xbc\xd6\xa5\x9b\x7f\x81\xe3\xd5\xcb\xe2\xbb\xc7", 16);
   EXPECT_EQ(ctx.hashType(), Cryptonight::SKEIN);
 }
+
+TYPED_TEST(HashCorrect, PipelineCorrect)
+{
+  auto &ctx = this->ctx;
+  EXPECT_EQ_A(ctx.hash(testvector, 14), "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54", 16);
+}
+
+TYPED_TEST(HashCorrect, HashNextCorrect)
+{
+  auto &ctx = this->ctx;
+  uint8_t blob[76];
+  for (size_t i = 0; i < sizeof(blob); ++i)
+    blob[i] = uint8_t(i * 7 + 3);
+
+  // Consecutive nonces, a jump and a new blob all have to match
+  TypeParam single;
+  ctx.setBlob(blob, sizeof(blob));
+  for (uint32_t nonce : {10, 11, 12, 40})
+  {
+    set32byte(blob, Cryptonight::NONCE_OFFSET, nonce);
+    EXPECT_EQ_A(ctx.hashNext(nonce), single.calculateResult(blob, sizeof(blob)), 32);
+  }
+  blob[0] ^= 1;
+  ctx.setBlob(blob, sizeof(blob));
+  set32byte(blob, Cryptonight::NONCE_OFFSET, 41);
+  EXPECT_EQ_A(ctx.hashNext(41), single.calculateResult(blob, sizeof(blob)), 32);
+}
+
+template <typename T, size_t N, bool... PREFETCH> void multiHashMatchesSingle()
+{
+  static const size_t len = 76;
+  uint8_t in[N * len];
+  for (size_t i = 0; i < sizeof(in); ++i)
+    in[i] = uint8_t(i * 13 + 7);
+
+  std::unique_ptr<T> ctx[N];
+  T *ptr[N];
+  for (size_t i = 0; i < N; ++i)
+  {
+    ctx[i].reset(new T);
+    ptr[i] = ctx[i].get();
+  }
+
+  T::template calculateResults<N, PREFETCH...>(ptr, in, len);
+
+  T single;
+  for (size_t i = 0; i < N; ++i)
+    EXPECT_EQ_A(ctx[i]->result(), single.calculateResult(in + i * len, len), 32);
+}
+
+TYPED_TEST(HashCorrect, CancelCorrect)
+{
+  auto &ctx = this->ctx;
+  std::atomic<bool> cancel(true);
+  ctx.setCancelFlag(&cancel);
+
+  // A raised flag gives up the hash, the next one runs to the end again
+  ctx.hash(testvector, 14);
+  EXPECT_TRUE(ctx.aborted());
+  cancel = false;
+  EXPECT_EQ_A(ctx.hash(testvector, 14), "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54", 16);
+  EXPECT_FALSE(ctx.aborted());
+}
+
+TYPED_TEST(HashCorrect, MultiCancelCorrect)
+{
+  static const size_t N = 3, len = 76;
+  uint8_t in[N * len];
+  for (size_t i = 0; i < sizeof(in); ++i)
+    in[i] = uint8_t(i * 13 + 7);
+
+  // The flag rises after the first context is done
+  std::atomic<bool> cancel(true);
+  std::unique_ptr<TypeParam> ctx[N];
+  TypeParam *ptr[N];
+  for (size_t i = 0; i < N; ++i)
+  {
+    ctx[i].reset(new TypeParam);
+    ctx[i]->setCancelFlag(i == 0 ? nullptr : &cancel);
+    ptr[i] = ctx[i].get();
+  }
+  Cryptonight::calculateResults<N>(ptr, in, len);
+  EXPECT_FALSE(ctx[0]->aborted());
+  EXPECT_TRUE(ctx[N - 1]->aborted());
+  EXPECT_TRUE(Cryptonight::anyAborted<N>(ptr));
+
+  cancel = false;
+  Cryptonight::calculateResults<N>(ptr, in, len);
+  EXPECT_FALSE(Cryptonight::anyAborted<N>(ptr));
+}
+
+TYPED_TEST(HashCorrect, ArenaCorrect)
+{
+  // Huge pages where the system has them, slow memory otherwise
+  const size_t size = Cryptonight::MEMORY, align = ScratchpadArena::HUGE_PAGE;
+  auto arena = std::make_shared<ScratchpadArena>(2, size, ScratchpadArena::HUGE_OR_SLOW);
+  EXPECT_EQ(arena->pad(1), arena->pad(0) + size);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(arena->pad(0)) % align, 0u);
+  EXPECT_LE(arena->hugeBytes(1), size);
+  EXPECT_EQ(arena->fellBack(), arena->pageSize() == 0);
+
+  TypeParam ctx0(Scratchpad(arena, 0)), ctx1(Scratchpad(arena, 1));
+  EXPECT_EQ(ctx1.scratchpad().get(), arena->pad(1));
+  EXPECT_EQ_A(ctx0.hash(testvector, 14), "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54", 16);
+  EXPECT_EQ_A(ctx1.hash(testvector, 14), "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54", 16);
+}
+
+TEST(ArenaCorrect, ColourCorrect)
+{
+  const size_t size = Cryptonight::MEMORY, colour = 4096 + 64;
+  auto arena = std::make_shared<ScratchpadArena>(3, size, ScratchpadArena::SLOW_MEMORY, false, colour);
+  EXPECT_EQ(arena->pad(2), arena->pad(0) + 2 * (size + colour));
+
+  // The last scratchpad is followed by a gap too, so it ends colour bytes
+  // before the end of the mapping and hashes like the others
+  arena->touch();
+  Cryptonight ctx(Scratchpad(arena, 2));
+  EXPECT_EQ_A(ctx.hash(testvector, 14), "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54", 16);
+}
+
+TYPED_TEST(HashCorrect, MultiHashCorrect)
+{
+  multiHashMatchesSingle<TypeParam, 2>();
+  multiHashMatchesSingle<TypeParam, 3>();
+  multiHashMatchesSingle<TypeParam, 4>();
+  multiHashMatchesSingle<TypeParam, 5>();
+}
+
+//! Whether the CPU runs the kernels built for an x86-64 level
+static bool cpuHasLevel(int level)
+{
+#ifdef __x86_64
+  switch (level)
+  {
+  case 2:
+    return __builtin_cpu_supports("x86-64-v2");
+  case 3:
+    return __builtin_cpu_supports("x86-64-v3");
+  case 4:
+    return __builtin_cpu_supports("x86-64-v4");
+  }
+#endif
+  return true;
+}
+
+TEST(KernelSetCorrect, LevelsCorrect)
+{
+  std::vector<KernelSet::Backend> backends = {KernelSet::GENERIC};
+#ifdef __x86_64
+  if (CryptonightSSSE3::detect())
+    backends.push_back(KernelSet::SSSE3);
+  if (CryptonightAESNI::detect())
+    backends.push_back(KernelSet::HW_AES);
+  if (CryptonightVAES::detect())
+    backends.push_back(KernelSet::VAES);
+#elif defined(__PPC64__) || defined(__sparcv9)
+  backends.push_back(KernelSet::HW_AES);
+#endif
+
+  // One input per final hash, the two of 20 bytes also go through two ways
+  struct vector
+  {
+    const char *in;
+    size_t len;
+    const char *out;
+  };
+  const vector vectors[] = {
+      {"This is a test", 14, "\xa0\x84\xf0\x1d\x14\x37\xa0\x9c\x69\x85\x40\x1b\x60\xd4\x35\x54"},
+      {"This is a quick test", 20, "\x1e\x27\x32\x1c\xe1\x2b\x20\xc2\x77\x3b\x28\xb5\x07\x61\x87\xa1"},
+      {"This is another test", 20, "\x18\x91\x05\x42\x8a\x6b\x09\x23\xe4\xfa\x41\x7e\x88\x36\x63\x4c"},
+      {"This is yet another quick test", 30, "\x48\x47\xcd\x48\xbc\xd6\xa5\x9b\x7f\x81\xe3\xd5\xcb\xe2\xbb\xc7"}};
+  uint8_t blob[76];
+  for (size_t i = 0; i < sizeof(blob); ++i)
+    blob[i] = uint8_t(i * 7 + 3);
+  Cryptonight single;
+  set32byte(blob, Cryptonight::NONCE_OFFSET, 5);
+  std::string next = bytestring(single.calculateResult(blob, sizeof(blob)), 32);
+
+  ASSERT_FALSE(KernelSet::all().empty());
+  for (const KernelSet *set : KernelSet::all())
+  {
+    if (!cpuHasLevel(set->level))
+      continue;
+    for (KernelSet::Backend backend : backends)
+    {
+      SCOPED_TRACE(std::string(set->name) + ", backend " + std::to_string(backend));
+      std::unique_ptr<Context> ctx[2] = {set->make(backend, Scratchpad()), set->make(backend, Scratchpad())};
+      Context *ptr[2] = {ctx[0].get(), ctx[1].get()};
+      for (const vector &v : vectors)
+      {
+        set->hash(backend, false, 1)(ptr, BS(v.in), v.len);
+        EXPECT_EQ_A(ctx[0]->result(), v.out, 16);
+      }
+
+      uint8_t in[40];
+      memcpy(in, vectors[1].in, 20);
+      memcpy(in + 20, vectors[2].in, 20);
+      set->hash(backend, true, 2)(ptr, in, 20);
+      EXPECT_EQ_A(ctx[0]->result(), vectors[1].out, 16);
+      EXPECT_EQ_A(ctx[1]->result(), vectors[2].out, 16);
+
+      ctx[0]->setBlob(blob, sizeof(blob));
+      EXPECT_EQ(bytestring(set->next(backend, false)(ptr[0], 5), 32), next);
+    }
+  }
+
+  // The highest level a CPU reaches picks its build, the baseline runs anywhere
+  EXPECT_EQ(&KernelSet::best(0), KernelSet::all().front());
+  EXPECT_EQ(&KernelSet::best(4), KernelSet::all().back());
+}
+
+TEST(TopologyCorrect, LookupsCorrect)
+{
+  topology *topo = topology::inst();
+  EXPECT_EQ(topo, topology::inst());
+
+  // No machine has a PU with this OS index
+  EXPECT_EQ(topo->numa_node(1 << 30), -1);
+  EXPECT_EQ(topo->core(1 << 30), -1);
+  EXPECT_EQ(topo->last_level_cache(1 << 30), -1);
+  EXPECT_EQ(topo->mid_level_cache(1 << 30), -1);
+
+#ifndef CONF_NO_HWLOC
+  // The tables agree with a walk over the tree
+  int depth = hwloc_get_type_depth(topo->get(), HWLOC_OBJ_PU);
+  ASSERT_EQ(topo->pus().size(), hwloc_get_nbobjs_by_depth(topo->get(), depth));
+  for (unsigned i = 0; i < hwloc_get_nbobjs_by_depth(topo->get(), depth); i++)
+  {
+    hwloc_obj_t pu = hwloc_get_obj_by_depth(topo->get(), depth, i);
+    EXPECT_EQ(topo->pus()[i], pu->os_index);
+    EXPECT_EQ(topo->numa_node(pu->os_index), hwloc_bitmap_first(pu->nodeset));
+    hwloc_obj_t core = hwloc_get_ancestor_obj_by_type(topo->get(), HWLOC_OBJ_CORE, pu);
+    if (core != nullptr)
+    {
+      EXPECT_EQ(topo->core(pu->os_index), (int)core->logical_index);
+    }
+
+    // A mid level cache only exists under an outermost one
+    if (topo->mid_level_cache(pu->os_index) >= 0)
+    {
+      EXPECT_GE(topo->last_level_cache(pu->os_index), 0);
+    }
+  }
+#endif
+}
+
+TEST(SeqSlotCorrect, StressCorrect)
+{
+  // A job sized value whose every byte says which publish it comes from
+  struct job
+  {
+    uint64_t version;
+    uint8_t blob[112];
+    uint64_t check;
+  };
+  const size_t threads = 128, jobs = 2000;
+  seqslot<job> slot;
+  std::atomic<bool> done(false);
+  std::atomic<size_t> torn(0), backwards(0);
+  std::vector<std::thread> readers;
+
+  for (size_t t = 0; t < threads; t++)
+  {
+    readers.emplace_back([&] {
+      job copy;
+      uint64_t last = 0;
+      while (!done.load())
+      {
+        std::this_thread::yield();
+        uint64_t ver = slot.read(copy, [] {});
+        if (ver < last) backwards++;
+        last = ver;
+        bool ok = copy.version == ver && copy.check == ~ver;
+        for (size_t i = 0; i < sizeof(copy.blob); i++)
+          ok = ok && copy.blob[i] == uint8_t(ver);
+        if (!ok && ver != 0) torn++;
+      }
+    });
+  }
+
+  // About two jobs a millisecond
+  for (uint64_t n = 1; n <= jobs; n++)
+  {
+    job next;
+    next.version = n;
+    memset(next.blob, int(uint8_t(n)), sizeof(next.blob));
+    next.check = ~n;
+    EXPECT_EQ(slot.publish(next, [] {}), n);
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+  }
+
+  done = true;
+  job last;
+  last.version = jobs + 1;
+  memset(last.blob, int(uint8_t(jobs + 1)), sizeof(last.blob));
+  last.check = ~last.version;
+  slot.publish(last, [] {});
+  for (std::thread &thd : readers)
+    thd.join();
+
+  EXPECT_EQ(torn.load(), 0u);
+  EXPECT_EQ(backwards.load(), 0u);
+  EXPECT_EQ(slot.version(), jobs + 1);
+}
+
+TEST(SeqSlotCorrect, CellCorrect)
+{
+  // A hash count and timestamp pair, as the miner threads write it
+  struct stats
+  {
+    uint64_t count;
+    uint64_t stamp;
+  };
+  const size_t readers = 16, writes = 200000;
+  seqcell<stats> cell;
+  std::atomic<bool> done(false);
+  std::atomic<size_t> torn(0), backwards(0);
+  std::vector<std::thread> thds;
+
+  for (size_t t = 0; t < readers; t++)
+  {
+    thds.emplace_back([&] {
+      uint64_t last = 0;
+      while (!done.load())
+      {
+        stats copy;
+        cell.read(copy);
+        if (copy.stamp != copy.count * 3) torn++;
+        if (copy.count < last) backwards++;
+        last = copy.count;
+        std::this_thread::yield();
+      }
+    });
+  }
+
+  for (uint64_t n = 1; n <= writes; n++)
+  {
+    stats next = {n, n * 3};
+    cell.write(next);
+  }
+  done = true;
+  for (std::thread &thd : thds)
+    thd.join();
+
+  stats last;
+  cell.read(last);
+  EXPECT_EQ(last.count, writes);
+  EXPECT_EQ(torn.load(), 0u);
+  EXPECT_EQ(backwards.load(), 0u);
+}
+
+TEST(HashSampleCorrect, SnapshotCorrect)
+{
+  // Threads of different rates (hashes per ms) that reported at different
+  // times, one of them stopped at 1000 and one never reported
+  const uint64_t rates[] = {2, 5, 12, 3};
+  const uint64_t last[] = {1005, 1007, 1011, 1016};
+  std::vector<hash_sample> samples(6);
+  for (size_t i = 0; i < 4; i++)
+  {
+    hash_sample &s = samples[i];
+    s = hash_sample();
+    s.iStep = 16 * rates[i];
+    s.report(rates[i] * (last[i] - 16), last[i] - 16);
+    s.report(rates[i] * last[i], last[i]);
+  }
+  samples[4] = hash_sample();
+  samples[4].iStep = 16;
+  samples[4].report(900, 950);
+  samples[4].idle(1000, 1000);
+  samples[5] = hash_sample();
+
+  // Every sample counts up to the same instant, whenever it was taken
+  const uint64_t stamp = 1020;
+  for (hash_sample &s : samples)
+    s.move_to(stamp);
+  for (size_t i = 0; i < 4; i++)
+  {
+    EXPECT_EQ(samples[i].iTimestamp, stamp);
+    EXPECT_EQ(samples[i].iHashCount, rates[i] * stamp);
+  }
+  EXPECT_EQ(samples[4].iTimestamp, stamp);
+  EXPECT_EQ(samples[4].iHashCount, 1000u);
+  EXPECT_EQ(samples[5].iTimestamp, 0u);
+  EXPECT_EQ(samples[5].iHashCount, 0u);
+
+  // An instant before the last report lies between the two reports
+  hash_sample s = hash_sample();
+  s.iStep = 16;
+  s.report(100, 100);
+  s.report(116, 108);
+  EXPECT_EQ(s.at(104), 108u);
+  EXPECT_EQ(s.at(90), 100u);
+
+  // Long after the last report the count stays below the next report
+  EXPECT_EQ(s.at(10000), 131u);
+}
+
+TEST(NonceDispenserCorrect, RangesCorrect)
+{
+  // More threads than the old nonce layout allowed share a job of 4096 ranges
+  const size_t threads = 300;
+  const uint32_t bits = 22, ranges = 1u << (bits - nonce_dispenser::iRangeBits);
+  nonce_dispenser nonces;
+  nonces.reset(7, bits);
+  std::vector<std::vector<uint32_t>> taken(threads);
+  std::vector<std::thread> workers;
+
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers.emplace_back([&, t] {
+      uint32_t offset;
+      while (nonces.next(7, offset))
+      {
+        taken[t].push_back(offset);
+        std::this_thread::yield();
+      }
+    });
+  }
+  for (std::thread &thd : workers)
+    thd.join();
+
+  // Every range went to exactly one thread
+  std::vector<uint32_t> all;
+  for (auto &v : taken)
+    all.insert(all.end(), v.begin(), v.end());
+  std::sort(all.begin(), all.end());
+  ASSERT_EQ(all.size(), ranges);
+  for (uint32_t i = 0; i < ranges; i++)
+    EXPECT_EQ(all[i], i << nonce_dispenser::iRangeBits);
+  EXPECT_EQ(nonces.handed_out(), ranges);
+  EXPECT_TRUE(nonces.first_to_run_out(7));
+  EXPECT_FALSE(nonces.first_to_run_out(7));
+
+  // An old job gets nothing and does not run out the next one, which starts over
+  uint32_t offset;
+  nonces.reset(8, bits);
+  EXPECT_FALSE(nonces.next(7, offset));
+  EXPECT_FALSE(nonces.first_to_run_out(7));
+  EXPECT_TRUE(nonces.next(8, offset));
+  EXPECT_EQ(offset, 0u);
+  EXPECT_TRUE(nonces.first_to_run_out(8));
+  EXPECT_FALSE(nonces.first_to_run_out(8));
+}
+
+TEST(NonceDispenserCorrect, SplitCorrect)
+{
+  // One slow and three fast owners run a job of 16 ranges dry and split
+  // each other's ranges at the end
+  const size_t owners = 4;
+  const uint32_t bits = 14, space = 1u << bits;
+  nonce_dispenser nonces;
+  nonces.reset(1, bits);
+  std::vector<nonce_range> ranges(owners);
+  std::vector<std::vector<uint32_t>> hashed(owners);
+  std::vector<std::thread> workers;
+  auto get = [](nonce_range &range) -> nonce_range & { return range; };
+
+  for (size_t t = 0; t < owners; t++)
+  {
+    workers.emplace_back([&, t] {
+      nonce_range &own = ranges[t];
+      own.clear(1);
+      uint32_t offset;
+      while (true)
+      {
+        if (!own.next(nonces, 1, offset))
+        {
+          if (!own.split_from(1, ranges.begin(), ranges.end(), get))
+            break;
+          continue;
+        }
+        hashed[t].push_back(offset);
+        if (t == 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    });
+  }
+  for (std::thread &thd : workers)
+    thd.join();
+
+  // No offset was hashed twice and none was left out
+  std::vector<uint32_t> all;
+  for (auto &v : hashed)
+    all.insert(all.end(), v.begin(), v.end());
+  std::sort(all.begin(), all.end());
+  ASSERT_EQ(all.size(), space);
+  for (uint32_t i = 0; i < space; i++)
+    EXPECT_EQ(all[i], i);
+
+  // A range of the last job is never split into the next one
+  uint32_t offset;
+  nonce_range old, current;
+  std::vector<nonce_range *> both = {&old, &current};
+  auto deref = [](nonce_range *range) -> nonce_range & { return *range; };
+  nonces.reset(2, nonce_dispenser::iRangeBits + 1);
+  ASSERT_TRUE(old.next(nonces, 2, offset));
+  nonces.reset(3, nonce_dispenser::iRangeBits);
+  current.clear(3);
+  for (uint32_t i = 0; i < nonce_dispenser::iRangeSize; i++)
+    ASSERT_TRUE(current.next(nonces, 3, offset));
+  EXPECT_FALSE(current.next(nonces, 3, offset));
+  EXPECT_FALSE(current.split_from(3, both.begin(), both.end(), deref));
+  EXPECT_TRUE(old.next(nonces, 2, offset));
+  EXPECT_EQ(offset, 1u);
+}
+
+TEST(TelemetryCorrect, WindowsCorrect)
+{
+  // Thread 0 reports 100 H/s every second, 600 ms into each second
+  const uint64_t t0 = 1000000000000, first = t0 + 600;
+  telemetry telem(2);
+  EXPECT_TRUE(std::isnan(telem.calc_telemetry_data(2500, 0, first)));
+  EXPECT_TRUE(std::isnan(telem.calc_ewma_data(0, 0)));
+  for (uint64_t k = 0; k <= 1200; k++)
+  {
+    telem.push_perf_value(0, 100 * k, first + 1000 * k);
+    // Repeats of the last sample are ignored
+    telem.push_perf_value(0, 100 * k, first + 1000 * k);
+    if (k == 0)
+    {
+      EXPECT_TRUE(std::isnan(telem.calc_ewma_data(0, 0)));
+    }
+    // The first window that starts after the first sample
+    if (k == 900)
+    {
+      EXPECT_TRUE(std::isnan(telem.calc_telemetry_data(900000, 0, first + 900000)));
+      EXPECT_DOUBLE_EQ(telem.calc_telemetry_data(900000, 0, first + 900001), 100.0);
+    }
+  }
+  const uint64_t last = first + 1000 * 1200;
+  for (size_t window : {2500, 60000, 900000})
+  {
+    EXPECT_DOUBLE_EQ(telem.calc_telemetry_data(window, 0, last + 200), 100.0) << window;
+    // No sample inside the window any more
+    EXPECT_TRUE(std::isnan(telem.calc_telemetry_data(window, 0, last + window + 1))) << window;
+    // Only windows that start after the first sample have data
+    EXPECT_TRUE(std::isnan(telem.calc_telemetry_data(window, 1, last)));
+  }
+
+  // The EWMAs follow a step to 200 H/s at their own pace
+  for (size_t k = 0; k < telemetry::iEwmaCount; k++)
+    EXPECT_DOUBLE_EQ(telem.calc_ewma_data(k, 0), 100.0);
+  telem.push_perf_value(0, 100 * 1200 + 200, last + 1000);
+  for (size_t k = 0; k < telemetry::iEwmaCount; k++)
+    EXPECT_DOUBLE_EQ(telem.calc_ewma_data(k, 0), 100.0 + 100.0 * (1.0 - std::exp(-1000.0 / telemetry::iEwmaWindows[k])));
+
+  // Thread 1 hashes 200 in the second before last and none in the last. The
+  // window starts in the bucket of the sample before those, 400 ms ahead of it.
+  for (uint64_t k = 0; k <= 8; k++)
+    telem.push_perf_value(1, 100 * k, first + 1000 * k);
+  telem.push_perf_value(1, 1000, first + 9000);
+  telem.push_perf_value(1, 1000, first + 10000);
+  EXPECT_DOUBLE_EQ(telem.calc_telemetry_data(2500, 1, first + 10100), 100.0);
+  EXPECT_DOUBLE_EQ(telem.calc_telemetry_data(2500, 1, first + 10500), 100.0);
+  // A millisecond later that sample is outside and the window starts with the next
+  EXPECT_DOUBLE_EQ(telem.calc_telemetry_data(2500, 1, first + 10501), 0.0);
+}
+
+TEST(AutotuneCorrect, CacheCorrect)
+{
+  const std::string file = testing::TempDir() + "autotune_correct.txt";
+  std::vector<autotune_cache::entry> saved = {{0, 1, "hw_aes", 1, false, 101.5},
+                                              {-1, 3, "generic", 2, true, 42.25}};
+  std::vector<autotune_cache::entry> loaded;
+
+  // A round trip keeps every field
+  ASSERT_TRUE(autotune_cache::save(file.c_str(), saved));
+  ASSERT_TRUE(autotune_cache::load(file.c_str(), 2, loaded));
+  ASSERT_EQ(loaded.size(), 2u);
+  for (size_t i = 0; i < 2; ++i)
+  {
+    EXPECT_EQ(loaded[i].iCpuAff, saved[i].iCpuAff);
+    EXPECT_EQ(loaded[i].iMaxWays, saved[i].iMaxWays);
+    EXPECT_EQ(loaded[i].sBackend, saved[i].sBackend);
+    EXPECT_EQ(loaded[i].iWays, saved[i].iWays);
+    EXPECT_EQ(loaded[i].bNoPrefetch, saved[i].bNoPrefetch);
+    EXPECT_EQ(loaded[i].fHps, saved[i].fHps);
+  }
+
+  // Tuned for another number of threads
+  EXPECT_FALSE(autotune_cache::load(file.c_str(), 3, loaded));
+
+  // A backend that is no longer allowed, or another thread config
+  const std::vector<std::string> backends = {"hw_aes", "generic"};
+  EXPECT_TRUE(autotune_cache::fits(saved[0], 0, 1, backends));
+  EXPECT_FALSE(autotune_cache::fits(saved[0], 0, 1, {"ssse3", "generic"}));
+  EXPECT_FALSE(autotune_cache::fits(saved[0], 1, 1, backends));
+  EXPECT_FALSE(autotune_cache::fits(saved[1], -1, 1, backends));
+
+  // Written on another host
+  {
+    std::ofstream out(file.c_str(), std::ios::trunc);
+    out << "host some other cpu | microcode 0x0 | Linux 0.0\n";
+    out << "thread 0 1 hw_aes 1 prefetch 101.5\n";
+  }
+  EXPECT_FALSE(autotune_cache::load(file.c_str(), 1, loaded));
+
+  // A malformed line spoils the whole file
+  for (const char *line : {"thread 0 1 hw_aes\n", "thread x 1 hw_aes 1 prefetch 1\n", "threads 0 1 hw_aes 1 prefetch 1\n"})
+  {
+    {
+      std::ofstream out(file.c_str(), std::ios::trunc);
+      out << "host " << autotune_cache::host_key() << "\n";
+      out << "thread 0 1 hw_aes 1 prefetch 101.5\n" << line;
+    }
+    EXPECT_FALSE(autotune_cache::load(file.c_str(), 2, loaded)) << line;
+  }
+
+  // A missing file
+  std::remove(file.c_str());
+  EXPECT_FALSE(autotune_cache::load(file.c_str(), 2, loaded));
+}
+
+#ifdef __x86_64
+TEST(AESNICorrect, NoPrefetchCorrect)
+{
+  multiHashMatchesSingle<CryptonightAESNI, 1, false>();
+  multiHashMatchesSingle<CryptonightAESNI, 3, false>();
+}
+#endif
 }
@@ -0,0 +1,158 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting
+ * work.
+  *
+  */
+
+#include "topology.h"
+#include "console.h"
+
+topology *topology::inst() {
+  // Never destroyed, the miner threads use it until the process ends
+  static topology *oInst = new topology;
+  return oInst;
+}
+
+#ifndef CONF_NO_HWLOC
+
+static bool is_cache(hwloc_obj_t obj) {
+#if HWLOC_API_VERSION >= 0x20000
+  return hwloc_obj_type_is_cache(obj->type);
+#else
+  return obj->type == HWLOC_OBJ_CACHE;
+#endif // HWLOC_API_VERSION
+}
+
+topology::topology() {
+  hwloc_topology_init(&oTopology);
+  hwloc_topology_load(oTopology);
+
+  // One walk over the PUs fills the tables every later lookup reads
+  int depth = hwloc_get_type_depth(oTopology, HWLOC_OBJ_PU);
+  unsigned n = hwloc_get_nbobjs_by_depth(oTopology, depth);
+  for (unsigned i = 0; i < n; i++) {
+    hwloc_obj_t pu = hwloc_get_obj_by_depth(oTopology, depth, i);
+    pu_info info = {-1, -1, -1, 0, false, -1, 0, pu};
+
+    if (pu->nodeset != nullptr)
+      info.iNode = hwloc_bitmap_first(pu->nodeset);
+
+    hwloc_obj_t core =
+        hwloc_get_ancestor_obj_by_type(oTopology, HWLOC_OBJ_CORE, pu);
+    if (core != nullptr)
+      info.iCore = (int)core->logical_index;
+
+    // Caches without a size say nothing, the one under them counts instead
+    hwloc_obj_t cache = nullptr;
+    for (hwloc_obj_t obj = pu->parent; obj != nullptr; obj = obj->parent) {
+      if (!is_cache(obj) || obj->attr == nullptr || obj->attr->cache.size == 0)
+        continue;
+      if (cache != nullptr) {
+        info.iMidCache = (int)cache->logical_index;
+        info.iMidCacheSize = cache->attr->cache.size;
+      }
+      cache = obj;
+    }
+    if (cache != nullptr) {
+      const char *inclusive = hwloc_obj_get_info_by_name(cache, "Inclusive");
+      info.iCache = (int)cache->logical_index;
+      info.iCacheSize = cache->attr->cache.size;
+      // Most caches are inclusive, so only an explicit Inclusive=0 counts
+      info.bExclusive = inclusive != nullptr && inclusive[0] == '0';
+    }
+
+    if (pu->os_index >= vPus.size()) {
+      vPus.resize(pu->os_index + 1);
+      vKnown.resize(pu->os_index + 1, false);
+    }
+    vPus[pu->os_index] = info;
+    vKnown[pu->os_index] = true;
+    vOrder.push_back(pu->os_index);
+  }
+}
+
+bool topology::bind_memory(size_t puId) const {
+  const pu_info *pu = find(puId);
+  if (pu == nullptr)
+    return false;
+
+#if HWLOC_API_VERSION >= 0x20000
+  int iRet = hwloc_set_membind(oTopology, pu->pObj->nodeset, HWLOC_MEMBIND_BIND,
+                               HWLOC_MEMBIND_THREAD | HWLOC_MEMBIND_BYNODESET);
+#else
+  int iRet = hwloc_set_membind_nodeset(oTopology, pu->pObj->nodeset,
+                                       HWLOC_MEMBIND_BIND, HWLOC_MEMBIND_THREAD);
+#endif // HWLOC_API_VERSION
+  if (0 > iRet) {
+    printer::inst()->print_msg(L0, "hwloc: can't bind memory");
+    return false;
+  }
+
+  printer::inst()->print_msg(L0, "hwloc: memory pinned");
+  return true;
+}
+
+#else
+
+topology::topology() {}
+
+bool topology::bind_memory(size_t) const { return false; }
+
+#endif // CONF_NO_HWLOC
+
+const topology::pu_info *topology::find(size_t puId) const {
+  return puId < vKnown.size() && vKnown[puId] ? &vPus[puId] : nullptr;
+}
+
+int topology::numa_node(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr ? pu->iNode : -1;
+}
+
+int topology::core(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr ? pu->iCore : -1;
+}
+
+int topology::last_level_cache(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr ? pu->iCache : -1;
+}
+
+size_t topology::last_level_cache_size(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr ? pu->iCacheSize : 0;
+}
+
+bool topology::last_level_cache_exclusive(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr && pu->bExclusive;
+}
+
+int topology::mid_level_cache(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr ? pu->iMidCache : -1;
+}
+
+size_t topology::mid_level_cache_size(size_t puId) const {
+  const pu_info *pu = find(puId);
+  return pu != nullptr ? pu->iMidCacheSize : 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+#ifndef CONF_NO_HWLOC
+#include <hwloc.h>
+#endif
+
+// The hwloc topology of the machine, loaded once for the whole process. The lookups
+// by PU (the OS index of a logical CPU, as in affine_to_cpu) are table reads.
+// Without hwloc every lookup answers -1 and binding does nothing.
+class topology
+{
+public:
+	// Loads the topology on the first call, safe to call from any thread
+	static topology* inst();
+
+	// The OS indexes of all PUs, in the order of the tree so PUs of one core and one
+	// cache are next to each other
+	const std::vector<size_t>& pus() const { return vOrder; }
+
+	// The first NUMA node local to the PU, -1 if unknown
+	int numa_node(size_t puId) const;
+	// The logical index of the core the PU belongs to, -1 if unknown
+	int core(size_t puId) const;
+	// The logical index of the outermost cache above the PU and its size in bytes,
+	// -1 and 0 if unknown. PUs with the same index share that cache.
+	int last_level_cache(size_t puId) const;
+	size_t last_level_cache_size(size_t puId) const;
+	// Whether the outermost cache does not hold copies of the caches under it,
+	// only when hwloc says so since most caches are inclusive
+	bool last_level_cache_exclusive(size_t puId) const;
+	// The same for the cache right under the outermost one, usually the L2
+	int mid_level_cache(size_t puId) const;
+	size_t mid_level_cache_size(size_t puId) const;
+
+	// Binds the memory the calling thread allocates to the NUMA node of the PU
+	bool bind_memory(size_t puId) const;
+
+#ifndef CONF_NO_HWLOC
+	// For walking the tree, only read it
+	hwloc_topology_t get() const { return oTopology; }
+#endif
+
+private:
+	topology();
+	topology(const topology&) = delete;
+	topology& operator=(const topology&) = delete;
+
+	struct pu_info
+	{
+		int iNode;
+		int iCore;
+		int iCache;
+		size_t iCacheSize;
+		bool bExclusive;
+		int iMidCache;
+		size_t iMidCacheSize;
+#ifndef CONF_NO_HWLOC
+		hwloc_obj_t pObj;
+#endif
+	};
+
+	// Indexed by the OS index of the PU, nullptr for indexes the machine does not have
+	const pu_info* find(size_t puId) const;
+	std::vector<pu_info> vPus;
+	std::vector<bool> vKnown;
+	std::vector<size_t> vOrder;
+
+#ifndef CONF_NO_HWLOC
+	hwloc_topology_t oTopology;
+#endif
+};
@@ -173,6 +173,9 @@ extern const char sHtmlResultBodyLow[] =
 extern const char sJsonApiThdHashrate[] =
 	"[%s,%s,%s]";
 
+extern const char sJsonApiThdScratchpads[] =
+	"{\"page_kb\":%u,\"count\":%u,\"huge\":%u,\"locked\":%s,\"numa_node\":%d,\"remote_pages\":%llu}";
+
 extern const char sJsonApiResultError[] =
 	"{\"count\":%llu,\"last_seen\":%llu,\"text\":\"%s\"}";
 
@@ -181,10 +184,25 @@ extern const char sJsonApiConnectionError[] =
 
 extern const char sJsonApiFormat [] =
 "{"
+	"\"kernels\":\"%s\","
+	"\"kernel_set\":\"%s\","
+	"\"scratchpads\":[%s],"
+
 	"\"hashrate\":{"
 		"\"threads\":[%s],"
 		"\"total\":%s,"
-		"\"highest\":%s"
+		"\"total_ewma\":%s,"
+		"\"highest\":%s,"
+		"\"aborted\":%llu,"
+		"\"switch_us\":%llu,"
+		"\"switch_worst_us\":%llu"
+	"},"
+
+	"\"nonces\":{"
+		"\"ranges_taken\":%u,"
+		"\"ranges\":%u,"
+		"\"ranges_split\":%llu,"
+		"\"jobs_ran_out\":%llu"
 	"},"
 
 	"\"results\":{"
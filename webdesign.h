@@ -19,6 +19,7 @@ extern const char sHtmlResultTableRow[];
 extern const char sHtmlResultBodyLow[];
 
 extern const char sJsonApiThdHashrate[];
+extern const char sJsonApiThdScratchpads[];
 extern const char sJsonApiResultError[];
 extern const char sJsonApiConnectionError[];
 extern const char sJsonApiFormat[];